@@ -2,53 +2,125 @@
 #include "Algorithm.h"
 #include "LocalMutation.h"
 #include "minmaxheap.h"
+#include "OrderStatisticTree.h"
+#include "QuantileSketch.h"
+#include "Parallel.h"
+#include <memory>
 
 enum class EESType {
-	ORIGINAL = 0,
-	ADAPTIVE = 1
+	ORIGINAL = 0, // Rings between fixed levels
+	ADAPTIVE = 1, // Rings of equal population, the rank ranges of all samples
+	SKETCH = 2 // Rings between the quantiles of a streaming sketch of the values, the samples are kept per ring as in ORIGINAL
 };
 
-template<uint32_t TDimension>
-class AdaptiveEESAlgorithm : public Algorithm<TDimension> {
+enum class EESSchedule {
+	CHAIN_BY_CHAIN = 0, // Every chain runs all its steps before the next colder one starts, rings hold whole runs of the hotter chains
+	PIPELINED = 1 // The chains step together, at step i a chain takes the states of step i of the hotter chains into its rings
+};
+
+template<uint32_t TDimension, typename TFloat = Float>
+class AdaptiveEESAlgorithm : public Algorithm<TDimension, TFloat> {
+	using Signature = typename Integrand<TDimension, TFloat>::StateSignature;
 	struct Sample {
 		INLINE Sample() = default;
-		Vector<TDimension> state;
-		Float value;
+		Vector<TDimension, TFloat> state;
+		TFloat value;
 		int chainNo;
 		bool operator<(const Sample& sample) const {
 			return this->value < sample.value;
 		}
 	};
 	struct Chain {
-		LocalMutation<TDimension>* mutator;
-		Float invTemperature;
+		LocalMutation<TDimension, TFloat>* mutator;
+		TFloat invTemperature;
 		Pcg random;
+		PcgLanes randomLanes; // Large steps
 		int swapAttempts, swaps;
+		Signature signature, proposedSignature; // Current state and the scratch space for proposals
 		
-		std::vector<Sample> backupRings;
-		std::vector<Heap<Sample>> rings;
-		std::vector<Float> levels;
+		std::vector<Heap<Sample>> rings; // ORIGINAL and SKETCH, split at the levels
+		std::vector<TFloat> levels;
+		QuantileSketch<TFloat> sketch; // SKETCH, its quantiles replace the levels from time to time, the samples stay in their rings
+		OrderStatisticTree<Sample> sorted; // ADAPTIVE, ring k is the rank range [k n / R, (k + 1) n / R) of the n samples
+		std::vector<uint64_t> ringSizes; // Summed over runs
+
+		// Reservoirs of bounded rings: ORIGINAL and SKETCH count the samples offered to every ring, ADAPTIVE those offered to all rings
+		// of the chain, as its rings are quantiles of what they hold. A separate generator, so the bound does not change
+		// the draws of the chain
+		Pcg ringRandom;
+		std::vector<uint64_t> ringOffered;
+		uint64_t offered;
+		size_t peakRingBytes;
+
+		// Inverse temperatures of this chain and the colder ones, the only chains that read the samples of this one. The
+		// hotter ones have finished (or, pipelined, never read them)
+		std::vector<TFloat> consumerInvTemperatures;
+
+		// Pipelined schedule: the state after each of the last PIPELINE_STEPS steps and its values at all temperatures, read
+		// by the colder chains. Step i is in slot i % PIPELINE_STEPS
+		std::vector<Vector<TDimension, TFloat>> publishedStates;
+		std::vector<TFloat> publishedValues; // [slot * chain count + chain]
+	};
+	// Steps of a chain, on their own cache line as other chains poll them
+	struct alignas(64) StepCount {
+		std::atomic<uint32_t> steps;
 	};
+	// Steps a chain publishes ahead of its slowest colder chain
+	static constexpr uint32_t PIPELINE_STEPS = 1024;
+	HeapArena<Sample> mArena; // Storage of the heap rings, a released ring gives it to the next one (declared first, so it outlives them)
 	std::vector<Chain> chains;
-	Float mLargeStepProb;
-	Float mEEJProb;
+	std::vector<StepCount> mPublishedSteps; // Whose entries are complete
+	std::vector<StepCount> mConsumedSteps; // Whose entries of the hotter chains have been read
+	std::vector<TFloat> invTemperatures; // Of all chains, for the batched evaluation
+	TFloat mLargeStepProb;
+	TFloat mEEJProb;
 	EESType mType;
+	EESSchedule mSchedule;
+	uint32_t mRingCount;
+	uint32_t mSketchAccuracy; // SKETCH, the quantiles are off by about 1 / accuracy in rank and are refreshed every accuracy values
+	uint32_t mRingCapacity; // Samples per ring, zero for unbounded rings. Small reservoirs repeat their jump targets, a few thousand keep the unbounded quality
+	uint32_t mRuns;
+	// Summed over runs: temperature lanes of the batched evaluation left out for the chains that do not read the samples
+	// (the forms of the state are computed once either way), and, chain by chain, inserts into the rings of finished chains
+	uint64_t mSkippedValues, mSkippedInserts;
+	size_t mArenaBytes; // Largest ring arena after a run
 public:
-	INLINE AdaptiveEESAlgorithm(const Integrand<TDimension>& integrand, std::vector<Float> temperatures, const int ringCount, const Float eEJProb, const EESType type) : 
-		Algorithm<TDimension>(integrand), mEEJProb(eEJProb), mType(type) {
+	// The threads only apply to the pipelined schedule, zero means all hardware threads (see setPool for the test suite),
+	// the results do not depend on the thread count. A ring capacity keeps a
+	// uniform reservoir of the samples of every ring instead of all of them. The sketch accuracy only applies to SKETCH,
+	// whose sketch takes a few times that many values whatever the run length
+	INLINE AdaptiveEESAlgorithm(const Integrand<TDimension, TFloat>& integrand, std::vector<Float> temperatures, const int ringCount, const Float eEJProb, const EESType type,
+		const EESSchedule schedule = EESSchedule::CHAIN_BY_CHAIN, const uint32_t threadCount = 1, const uint32_t ringCapacity = 0, const uint32_t sketchAccuracy = 200) : 
+		Algorithm<TDimension, TFloat>(integrand), mPublishedSteps(temperatures.size()), mConsumedSteps(temperatures.size()), mEEJProb(eEJProb), mType(type), mSchedule(schedule),
+		mRingCount(ringCount), mSketchAccuracy(sketchAccuracy), mRingCapacity(ringCapacity), mRuns(0), mSkippedValues(0), mSkippedInserts(0), mArenaBytes(0) {
+		this->checkChainCount(temperatures.size());
+		assert(mRingCapacity == 0 || mRingCapacity > 1);
 		mLargeStepProb = 0.3f;
+		if (mSchedule == EESSchedule::PIPELINED) {
+			this->setThreadCount(threadCount);
+		}
 		std::sort(temperatures.begin(), temperatures.end());
 		assert(temperatures.size() > 0 && temperatures[0] == 1.f);
 		chains.resize(temperatures.size());
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			chains[i].invTemperature = 1.f / temperatures[i];
-			chains[i].random.reset(1337 * i + 235, 1579 * i + 454);
-			chains[i].mutator = new LocalMutation<TDimension>(chains[i].random);
+			invTemperatures.push_back(chains[i].invTemperature);
+			chains[i].consumerInvTemperatures = invTemperatures;
+			chains[i].mutator = new LocalMutation<TDimension, TFloat>(chains[i].random);
 			chains[i].swapAttempts = 0;
 			chains[i].swaps = 0;
-			chains[i].rings.resize(ringCount);
+			if (mType != EESType::ADAPTIVE) {
+				for (int ringIndex = 0; ringIndex < ringCount; ++ringIndex) {
+					chains[i].rings.emplace_back(&mArena);
+				}
+			}
+			chains[i].sketch = QuantileSketch<TFloat>(sketchAccuracy);
+			chains[i].ringSizes.resize(ringCount, 0);
+			chains[i].ringOffered.resize(ringCount, 0);
+			chains[i].peakRingBytes = 0;
 			computeLevels(chains[i].levels, integrand.maxValue(chains[i].invTemperature));
 		}
+		seed(Pcg(0xDEAD));
 	}
 
 	virtual ~AdaptiveEESAlgorithm() override {
@@ -57,69 +129,56 @@ public:
 		}
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			do {
-				chains[i].mutator->setState(randomVector<TDimension>(chains[i].random));
-			} while (value(chains[i].mutator->getState(), i) == Float(0));
+				const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(chains[i].random);
+				chains[i].mutator->setState(state, logValue(state, i));
+			} while (exp(chains[i].mutator->getLogValue()) == TFloat(0)); // Start where the value does not underflow
 			chains[i].mutator->startAdaptation(0.3f);
+			this->mIntegrand.signature(chains[i].mutator->getState(), chains[i].signature);
 			for (Heap<Sample>& ring : chains[i].rings) {
 				ring.clear();
 			}
-			chains[i].backupRings.clear();
+			chains[i].sorted.clear();
+			if (mType == EESType::SKETCH) {
+				chains[i].sketch.clear();
+				computeLevels(chains[i].levels, this->mIntegrand.maxValue(chains[i].invTemperature)); // Until the sketch has enough values
+			}
+			std::fill(chains[i].ringOffered.begin(), chains[i].ringOffered.end(), 0);
+			chains[i].offered = 0;
 		}
 
-		for (int c = int(chains.size()) - 1; c >= 0; --c) {
-			for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
-				
-					const bool localStep = i % 3 != 0;
-					Vector<TDimension> proposed;
-					if (localStep) {
-						proposed = chains[c].mutator->mutateState();
-					}
-					else {
-						proposed = randomVector<TDimension>(chains[c].random);
-					}
-					if (acceptRatio(chains[c].mutator->getState(), proposed, c) > chains[c].random()) {
-						chains[c].mutator->mutationWasAccepted(proposed, localStep);
-					}
-					else {
-						chains[c].mutator->mutationWasRejected(localStep);
-					}
-					/*++chains[c].swapAttempts;
-					if (c != chains.size() - 1 && swapRatio(c, c + 1) > chains[c].random()) {
-						++chains[c].swaps;
-						auto temp = chains[c].mutator->getState();
-						chains[c].mutator->setState(chains[c + 1].mutator->getState());
-						chains[c + 1].mutator->setState(temp);
-					}*/
-					for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-						if (c2 != c) {
-							addToRing(chains[c].mutator->getState(), c2, c);
-						}
+		if (mSchedule == EESSchedule::PIPELINED) {
+			runPipelined(samples);
+		}
+		else {
+			std::vector<TFloat> stateValues; // Value of the current state at the temperatures of all chains
+			for (int c = int(chains.size()) - 1; c >= 0; --c) {
+				const uint32_t steps = uint32_t(samples.size()) + MCMC_BURN_PERIOD;
+				for (uint32_t i = 0; i < steps; ++i) {
+					step(c, i);
+					this->mIntegrand.valueAllTemperatures(chains[c].signature, chains[c].consumerInvTemperatures, stateValues);
+					for (int c2 = c - 1; c2 >= 0; --c2) {
+						addToRing(chains[c].mutator->getState(), stateValues[c2], c2, c);
 					}
-				
-				
 					if (c == 0 && i >= MCMC_BURN_PERIOD) {
 						const uint32_t index = i - MCMC_BURN_PERIOD;
 						samples[index].sample = chains[c].mutator->getState();
-						samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
-					}
-
-					if (ringsConstructed(c) && mEEJProb > chains[c].random()) {
-						++chains[c].swapAttempts;
-						const Float v = value(chains[c].mutator->getState(), c);
-						const int ringIndex = mType == EESType::ORIGINAL ? ringNumberLevels(chains[c].levels, v) : findRing(v, c);
-						const Heap<Sample>& ring = chains[c].rings[ringIndex];
-						const int sampleIndex = clamp(int(chains[c].random() * ring.size()), 0, int(ring.size() - 1));
-						const Sample& s = ring.get(sampleIndex);
-						if (swapRatio(c, s) > chains[c].random()) {
-							++chains[c].swaps;
-							chains[c].mutator->setState(s.state);
-						}
+						samples[index].pdf = stateValues[0];
 					}
+					equiEnergyJump(c, stateValues[c]);
+				}
+				releaseRings(c);
 			}
 		}
+		++mRuns;
+		const uint64_t skipped = uint64_t(samples.size() + MCMC_BURN_PERIOD) * (chains.size() * (chains.size() - 1) / 2);
+		mSkippedValues += skipped;
+		if (mSchedule == EESSchedule::CHAIN_BY_CHAIN) {
+			mSkippedInserts += skipped;
+		}
+		mArenaBytes = std::max(mArenaBytes, mArena.bytes());
 	}
 
 	static std::string sName() {
@@ -127,47 +186,238 @@ public:
 	}
 
 	virtual std::string name() const override {
-		return sName();
+		std::string name = sName();
+		if (mType == EESType::ORIGINAL) {
+			name += " - Original";
+		}
+		else if (mType == EESType::ADAPTIVE) {
+			name += " - Adaptive";
+		}
+		else {
+			name += " - Sketch";
+		}
+		if (mSchedule == EESSchedule::PIPELINED) {
+			name += " - Pipelined";
+		}
+		return name;
 	}
 
 	virtual bool hasNormalizedPdf() const override { return false; }
 
 	virtual void printStats() const override {
+		size_t ringBytes = 0;
 		for (uint32_t i = 0; i < chains.size(); ++i) {
-			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << Float(100) * chains[i].mutator->acceptanceRate()
-				<< " % Swap rate: " << Float(100) * (chains[i].swaps / Float(chains[i].swapAttempts)) << " %" << std::endl;
-			for (int ringIndex = 0; ringIndex < chains[i].rings.size(); ++ringIndex) {
-				std::cout << chains[i].rings[ringIndex].size() << " ";
+			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << TFloat(100) * chains[i].mutator->acceptanceRate()
+				<< " % Swap rate: " << TFloat(100) * (chains[i].swaps / TFloat(chains[i].swapAttempts)) << " %" << std::endl;
+			for (uint32_t ringIndex = 0; ringIndex < mRingCount; ++ringIndex) {
+				std::cout << chains[i].ringSizes[ringIndex] / std::max(mRuns, 1u) << " ";
 			}
-			std::cout << std::endl;
+			std::cout << "(" << chains[i].peakRingBytes / double(1 << 20) << " MiB)" << std::endl;
+			ringBytes += chains[i].peakRingBytes;
+		}
+		std::cout << "Ring memory: " << ringBytes / double(1 << 20) << " MiB peak";
+		if (mType != EESType::ADAPTIVE) {
+			std::cout << ", " << mArenaBytes / double(1 << 20) << " MiB allocated";
+		}
+		if (mRingCapacity > 0) {
+			std::cout << ", at most " << mRingCapacity << " samples per ring";
+		}
+		std::cout << std::endl;
+		std::cout << "Ring feeding: " << mSkippedValues / std::max(mRuns, 1u) << " temperature values not computed and "
+			<< mSkippedInserts / std::max(mRuns, 1u) << " ring inserts avoided per run" << std::endl;
+	}
+
+	virtual void seed(const Pcg& stream) override {
+		Algorithm<TDimension, TFloat>::seed(stream);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			const Pcg chain = this->chainStream(stream, i);
+			chains[i].random = chain.stream(0, PCG_GENERATOR_STREAM);
+			chains[i].randomLanes.reset(chain, 1, PCG_GENERATOR_STREAM);
+			chains[i].ringRandom = chain.stream(this->FIRST_FREE_GENERATOR, PCG_GENERATOR_STREAM);
 		}
 	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		const AdaptiveEESAlgorithm& algorithm = static_cast<const AdaptiveEESAlgorithm&>(other);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			chains[i].mutator->mergeStats(*algorithm.chains[i].mutator);
+			chains[i].swapAttempts += algorithm.chains[i].swapAttempts;
+			chains[i].swaps += algorithm.chains[i].swaps;
+			for (uint32_t ringIndex = 0; ringIndex < mRingCount; ++ringIndex) {
+				chains[i].ringSizes[ringIndex] += algorithm.chains[i].ringSizes[ringIndex];
+			}
+			chains[i].peakRingBytes = std::max(chains[i].peakRingBytes, algorithm.chains[i].peakRingBytes);
+		}
+		mRuns += algorithm.mRuns;
+		mSkippedValues += algorithm.mSkippedValues;
+		mSkippedInserts += algorithm.mSkippedInserts;
+		mArenaBytes = std::max(mArenaBytes, algorithm.mArenaBytes);
+	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed, const uint32_t chainNo) const {
-		const Float valCurr = this->mIntegrand.value(current, chains[chainNo].invTemperature);
-		const Float valProp = this->mIntegrand.value(proposed, chains[chainNo].invTemperature);
-		return valCurr > Float(0) ? std::min(Float(1), valProp / valCurr) : Float(1);
+	// The chains are split into as many blocks as there are threads, every thread steps the chains of its block together
+	// (hottest first, so a chain never waits for one after it on the same thread), without a pool one block holds them all.
+	// The hand-off is a ring of published steps: a chain writes the entries of a step and then releases its published
+	// count, the colder chains acquire it before they read the entries and release their consumed count after, which the
+	// chain acquires before it writes over the slot. Nothing else is shared, so the result does not depend on the thread
+	// count. The entries are freed at the end of the run
+	void runPipelined(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) {
+		const uint32_t steps = uint32_t(samples.size()) + MCMC_BURN_PERIOD;
+		const uint32_t chainCount = uint32_t(chains.size());
+		for (uint32_t c = 0; c < chainCount; ++c) {
+			chains[c].publishedStates.resize(PIPELINE_STEPS);
+			chains[c].publishedValues.resize(size_t(PIPELINE_STEPS) * chainCount);
+			mPublishedSteps[c].steps.store(0, std::memory_order_relaxed);
+			mConsumedSteps[c].steps.store(0, std::memory_order_relaxed);
+		}
+		// Every block must have a thread of its own, as the chains of one wait for those of the others
+		ThreadPool* pool = this->pool();
+		const uint32_t blocks = pool ? std::min(pool->threadCount(), chainCount) : 1;
+		const auto runBlock = [this, steps, chainCount, blocks, &samples](const uint32_t block, const uint32_t) {
+			const uint32_t first = chainCount - 1 - block * chainCount / blocks, last = chainCount - (block + 1) * chainCount / blocks;
+			std::vector<TFloat> stateValues;
+			for (uint32_t i = 0; i < steps; ++i) {
+				for (int c = int(first); c >= int(last); --c) {
+					pipelinedStep(c, i, stateValues, samples);
+				}
+			}
+			for (int c = int(first); c >= int(last); --c) {
+				releaseRings(c);
+			}
+		};
+		if (pool) {
+			pool->parallelFor(blocks, runBlock);
+		}
+		else {
+			runBlock(0, 0);
+		}
+		for (Chain& chain : chains) {
+			std::vector<Vector<TDimension, TFloat>>().swap(chain.publishedStates);
+			std::vector<TFloat>().swap(chain.publishedValues);
+		}
+	}
+
+	INLINE void pipelinedStep(const uint32_t c, const uint32_t i, std::vector<TFloat>& stateValues, std::vector<SampleAndPdf<TDimension, TFloat>>& samples) {
+		const uint32_t chainCount = uint32_t(chains.size());
+		const uint32_t slot = i % PIPELINE_STEPS;
+		step(c, i);
+		this->mIntegrand.valueAllTemperatures(chains[c].signature, chains[c].consumerInvTemperatures, stateValues);
+		if (i >= PIPELINE_STEPS) {
+			for (uint32_t c2 = 0; c2 < c; ++c2) {
+				while (mConsumedSteps[c2].steps.load(std::memory_order_acquire) <= i - PIPELINE_STEPS) {
+					std::this_thread::yield();
+				}
+			}
+		}
+		chains[c].publishedStates[slot] = chains[c].mutator->getState();
+		std::copy(stateValues.begin(), stateValues.end(), chains[c].publishedValues.begin() + size_t(slot) * chainCount); // Only the colder chains
+		mPublishedSteps[c].steps.store(i + 1, std::memory_order_release);
+		for (uint32_t c2 = chainCount - 1; c2 > c; --c2) {
+			while (mPublishedSteps[c2].steps.load(std::memory_order_acquire) <= i) {
+				std::this_thread::yield();
+			}
+			addToRing(chains[c2].publishedStates[slot], chains[c2].publishedValues[size_t(slot) * chainCount + c], c, c2);
+		}
+		mConsumedSteps[c].steps.store(i + 1, std::memory_order_release);
+		if (c == 0 && i >= MCMC_BURN_PERIOD) {
+			const uint32_t index = i - MCMC_BURN_PERIOD;
+			samples[index].sample = chains[c].mutator->getState();
+			samples[index].pdf = stateValues[0];
+		}
+		equiEnergyJump(c, stateValues[c]);
+	}
+
+	// Only the chain itself reads its rings, once it has finished they are freed (the next run allocates them again)
+	void releaseRings(const uint32_t c) {
+		Chain& chain = chains[c];
+		size_t ringBytes = chain.sorted.bytes() + chain.sketch.bytes();
+		for (uint32_t ringIndex = 0; ringIndex < mRingCount; ++ringIndex) {
+			if (mType != EESType::ADAPTIVE) {
+				chain.ringSizes[ringIndex] += chain.rings[ringIndex].size();
+				ringBytes += chain.rings[ringIndex].capacity() * sizeof(Sample);
+				chain.rings[ringIndex].release();
+			}
+			else {
+				chain.ringSizes[ringIndex] += ringBegin(ringIndex + 1, chain.sorted.size()) - ringBegin(ringIndex, chain.sorted.size());
+			}
+		}
+		chain.peakRingBytes = std::max(chain.peakRingBytes, ringBytes);
+		chain.sorted.release();
+	}
+
+	INLINE void step(const uint32_t c, const uint32_t i) {
+		const bool localStep = i % 3 != 0;
+		Vector<TDimension, TFloat> proposed;
+		if (localStep) {
+			proposed = chains[c].mutator->mutateState();
+		}
+		else {
+			proposed = randomVector<TDimension, TFloat>(chains[c].randomLanes);
+		}
+		this->mIntegrand.signature(proposed, chains[c].proposedSignature);
+		const TFloat logProposed = logValue(chains[c].proposedSignature, c);
+		if (acceptRatio(c, logProposed) > chains[c].random()) {
+			chains[c].mutator->mutationWasAccepted(proposed, logProposed, localStep);
+			std::swap(chains[c].signature, chains[c].proposedSignature);
+		}
+		else {
+			chains[c].mutator->mutationWasRejected(localStep);
+		}
+	}
+
+	// Jump to a sample of the ring of the current value (at the temperature of the chain)
+	INLINE void equiEnergyJump(const uint32_t c, const TFloat v) {
+		if (ringsConstructed(c) && mEEJProb > chains[c].random()) {
+			++chains[c].swapAttempts;
+			size_t ringStart, ringSize;
+			const Heap<Sample>* ring = nullptr;
+			if (mType != EESType::ADAPTIVE) {
+				ring = &chains[c].rings[ringNumberLevels(chains[c].levels, v)];
+				ringStart = 0;
+				ringSize = ring->size();
+			}
+			else {
+				const uint32_t ringIndex = findRing(v, c);
+				ringStart = ringBegin(ringIndex, chains[c].sorted.size());
+				ringSize = ringBegin(ringIndex + 1, chains[c].sorted.size()) - ringStart;
+			}
+			const size_t sampleIndex = std::min(size_t(chains[c].random() * ringSize), ringSize - 1);
+			const Sample& s = ring ? ring->get(sampleIndex) : chains[c].sorted.get(ringStart + sampleIndex);
+			this->mIntegrand.signature(s.state, chains[c].proposedSignature);
+			TFloat logSample;
+			if (swapRatio(c, s, chains[c].proposedSignature, logSample) > chains[c].random()) {
+				++chains[c].swaps;
+				chains[c].mutator->setState(s.state, logSample);
+				std::swap(chains[c].signature, chains[c].proposedSignature);
+			}
+		}
+	}
+
+	INLINE TFloat acceptRatio(const uint32_t chainNo, const TFloat logProposed) const {
+		const TFloat logCurr = chains[chainNo].mutator->getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
 	}
 
-	INLINE Float swapRatio(const uint32_t chain1, const Sample& s) const {
-		const auto state1 = chains[chain1].mutator->getState();
-		const auto state2 = s.state;
-		const Float val1_t1 = this->mIntegrand.value(state1, chains[chain1].invTemperature);
-		const Float val1_t2 = this->mIntegrand.value(state1, chains[s.chainNo].invTemperature);
-		const Float val2_t1 = this->mIntegrand.value(state2, chains[chain1].invTemperature);
-		const Float val2_t2 = this->mIntegrand.value(state2, chains[s.chainNo].invTemperature);
-		const Float factor1 = val1_t2 / val1_t1;
-		const Float factor2 = val2_t1 / val2_t2;
-		return std::min(Float(1), factor1 * factor2);
+	// The value of the sample at the temperature of the chain is returned for setState
+	INLINE TFloat swapRatio(const uint32_t chain1, const Sample& s, const Signature& sampleSignature, TFloat& log2_t1) const {
+		const Signature& signature1 = chains[chain1].signature;
+		const TFloat log1_t1 = chains[chain1].mutator->getLogValue();
+		const TFloat log1_t2 = logValue(signature1, s.chainNo);
+		log2_t1 = logValue(sampleSignature, chain1);
+		const TFloat log2_t2 = logValue(sampleSignature, s.chainNo);
+		return ratioFromLog((log1_t2 - log1_t1) + (log2_t1 - log2_t2));
 	}
 
-	INLINE Float value(const Vector<TDimension>& state, const uint32_t chainNo) const {
-		return this->mIntegrand.value(state, chains[chainNo].invTemperature);
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& state, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(state, chains[chainNo].invTemperature);
+	}
+
+	INLINE TFloat logValue(const Signature& signature, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(signature, chains[chainNo].invTemperature);
 	}
 
 	INLINE bool ringsConstructed(const uint32_t chainNo) const {
-		const std::vector<Heap<Sample>>& rings = chains[chainNo].rings;
-		if (mType == EESType::ORIGINAL) {
+		if (mType != EESType::ADAPTIVE) {
+			const std::vector<Heap<Sample>>& rings = chains[chainNo].rings;
 			for (int ringIndex = 0; ringIndex < rings.size(); ++ringIndex) {
 				if (rings[ringIndex].size() == 0) {
 					return false;
@@ -175,125 +425,99 @@ private:
 			}
 			return true;
 		}
-		
-		const std::vector<Sample>& backupRings = chains[chainNo].backupRings;
-		return backupRings.size() == rings.size();
+		return chains[chainNo].sorted.size() >= mRingCount; // No ring is empty
+	}
+
+	// First rank of an ADAPTIVE ring, ringBegin(mRingCount, n) == n
+	INLINE size_t ringBegin(const uint32_t ringIndex, const size_t sampleCount) const {
+		return size_t(uint64_t(ringIndex) * sampleCount / mRingCount);
 	}
 
-	INLINE int findRing(const Float value, const uint32_t chainNo) {
+	// The ring of the first sample not below the value, the last ring above all of them
+	INLINE uint32_t findRing(const TFloat value, const uint32_t chainNo) const {
 		assert(ringsConstructed(chainNo));
-		const std::vector<Heap<Sample>>& rings = chains[chainNo].rings;
-		int ringIndex = 0;
-		for (; ringIndex < rings.size() - 1; ++ringIndex) {
-			if (rings[ringIndex].maximum().value >= value) {
-				break;
-			}
+		const OrderStatisticTree<Sample>& sorted = chains[chainNo].sorted;
+		Sample probe;
+		probe.value = value;
+		const size_t rank = std::min(sorted.lowerRank(probe), sorted.size() - 1);
+		uint32_t ringIndex = uint32_t(std::min(uint64_t(rank) * mRingCount / sorted.size(), uint64_t(mRingCount - 1)));
+		while (ringBegin(ringIndex, sorted.size()) > rank) {
+			--ringIndex;
+		}
+		while (ringIndex + 1 < mRingCount && ringBegin(ringIndex + 1, sorted.size()) <= rank) {
+			++ringIndex;
 		}
 		return ringIndex;
 	}
 
-	INLINE void computeLevels(std::vector<Float>& levels, const Float maxValue) {
-		levels.resize(chains[0].rings.size()-1);
-		const Float dist = pow(maxValue, 1 / Float(chains[0].rings.size()));
-		Float it(0);
-		for (Float & l : levels) {
+	INLINE void computeLevels(std::vector<TFloat>& levels, const TFloat maxValue) {
+		levels.resize(mRingCount - 1);
+		const TFloat dist = pow(maxValue, 1 / TFloat(mRingCount));
+		TFloat it(0);
+		for (TFloat & l : levels) {
 			it += dist;
 			l = it;
 		}
 	}
 
-	INLINE uint32_t ringNumberLevels(const std::vector<Float>& levels, Float value) {
-		for (uint32_t i = 0; i < uint32_t(levels.size()); ++i) {
-			if (levels[i] > value) {
-				return i;
-			}
-		}
-		return uint32_t(levels.size());
+	// The first level above the value, a binary search over the R - 1 levels
+	INLINE uint32_t ringNumberLevels(const std::vector<TFloat>& levels, TFloat value) const {
+		return uint32_t(std::upper_bound(levels.begin(), levels.end(), value) - levels.begin());
 	}
 
-	INLINE void addToRing(const Vector<TDimension>& state, const uint32_t chainNo, const uint32_t sampleChainNo) {
-		std::vector<Heap<Sample>>& rings = chains[chainNo].rings;
-		std::vector<Sample>& backupRings = chains[chainNo].backupRings;
+	INLINE void addToRing(const Vector<TDimension, TFloat>& state, const TFloat value, const uint32_t chainNo, const uint32_t sampleChainNo) {
 		Sample s;
-		s.value = value(state, chainNo);
-		if (s.value == Float(0)) {
+		s.value = value;
+		if (s.value == TFloat(0)) {
 			return;
 		}
 		s.state = state;
 		s.chainNo = sampleChainNo;
-		if (mType == EESType::ORIGINAL) {
-			rings[ringNumberLevels(chains[chainNo].levels, s.value)].add(s);
-			return;
-		}
-		if (!ringsConstructed(chainNo)) {
-			backupRings.push_back(s);
-			if (backupRings.size() == rings.size()) {
-				// Copy to rings
-				std::sort(backupRings.begin(), backupRings.end());
-				for (int i = 0; i < rings.size(); ++i) {
-					rings[i].add(backupRings[i]);
+		Chain& chain = chains[chainNo];
+		if (mType != EESType::ADAPTIVE) {
+			std::vector<Heap<Sample>>& rings = chain.rings;
+			if (mType == EESType::SKETCH) {
+				// Quickly at first (at every power of two), then at the accuracy, so the sorting of the query stays amortized
+				chain.sketch.add(s.value);
+				const uint64_t count = chain.sketch.count();
+				if (count >= mRingCount && ((count & (count - 1)) == 0 || count % mSketchAccuracy == 0)) {
+					chain.sketch.quantiles(chain.levels);
 				}
 			}
-			return;
-		}
-		// Rings are already constructed and each should containt at least one sample
-		int ringIndex = findRing(s.value, chainNo);
-		assert(ringIndex >= 0 && ringIndex < rings.size());
-		rings[ringIndex].add(s);
-		// Fix the rings if necessary
-		Float averageSize(0);
-		for (int i = 0; i < rings.size(); ++i) {
-			averageSize += rings[i].size();
-		}
-		averageSize /= rings.size();
-		int direction = 0;
-		while (rings[ringIndex].size() > (size_t(averageSize) + 5)) {
-			int newIndex = -1;
-			if (direction == 0) {
-				if ((ringIndex + 1) < rings.size()) {
-					newIndex = ringIndex + 1;
-					direction = 1;
-				}
-				if (ringIndex > 0 && (newIndex == -1 || rings[newIndex].size() > rings[ringIndex - 1].size())) {
-					newIndex = ringIndex - 1;
-					direction = -1;
-				}
+			const uint32_t ringIndex = ringNumberLevels(chain.levels, s.value);
+			const uint64_t offered = ++chain.ringOffered[ringIndex];
+			if (mRingCapacity == 0 || offered <= mRingCapacity) {
+				rings[ringIndex].add(s);
 			}
 			else {
-				newIndex = ringIndex + direction;
-				if (newIndex < 0 || newIndex == rings.size()) {
-					newIndex = -1;
+				// Kept with probability capacity / offered in place of a uniform one, so the ring stays a uniform sample
+				const uint64_t slot = std::min(uint64_t(chain.ringRandom() * offered), offered - 1);
+				if (slot < mRingCapacity) {
+					rings[ringIndex].updateValue(s, size_t(slot));
 				}
 			}
-			if (newIndex == -1 || rings[newIndex].size() >= rings[ringIndex].size()) {
-				break; // Nowhere to shift
-			}
-			if (newIndex < ringIndex) {
-				const Sample s = rings[ringIndex].minimum();
-				rings[ringIndex].remove_min();
-				rings[newIndex].add(s);
-			}
-			else {
-				const Sample s = rings[ringIndex].maximum();
-				rings[ringIndex].remove_max();
-				rings[newIndex].add(s);
-			}
-			ringIndex = newIndex;
+			return;
 		}
-		for (int i = 0; i < rings.size() - 1; ++i) {
-			assert(rings[i].maximum().value <= rings[i + 1].minimum().value);
+		const uint64_t offered = ++chain.offered;
+		if (mRingCapacity != 0 && offered > uint64_t(mRingCapacity) * mRingCount) {
+			// The reservoir is full, the slot is the rank of the sample to drop
+			const uint64_t slot = std::min(uint64_t(chain.ringRandom() * offered), offered - 1);
+			if (slot >= uint64_t(mRingCapacity) * mRingCount) {
+				return;
+			}
+			chain.sorted.removeAt(size_t(slot));
 		}
+		// The rings are rank ranges, they stay balanced without moving samples between them
+		chain.sorted.add(s);
 	}
 
-	INLINE Float swapRatio(const uint32_t chain1, const uint32_t chain2) const {
-		const auto state1 = chains[chain1].mutator->getState();
-		const auto state2 = chains[chain2].mutator->getState();
-		const Float val1_t1 = this->mIntegrand.value(state1, chains[chain1].invTemperature);
-		const Float val1_t2 = this->mIntegrand.value(state1, chains[chain2].invTemperature);
-		const Float val2_t1 = this->mIntegrand.value(state2, chains[chain1].invTemperature);
-		const Float val2_t2 = this->mIntegrand.value(state2, chains[chain2].invTemperature);
-		const Float factor1 = val1_t1 / val1_t2;
-		const Float factor2 = val2_t1 / val2_t2;
-		return std::min(Float(1), factor1 * factor2);
+	INLINE TFloat swapRatio(const uint32_t chain1, const uint32_t chain2) const {
+		const Signature& signature1 = chains[chain1].signature;
+		const Signature& signature2 = chains[chain2].signature;
+		const TFloat log1_t1 = logValue(signature1, chain1);
+		const TFloat log1_t2 = logValue(signature1, chain2);
+		const TFloat log2_t1 = logValue(signature2, chain1);
+		const TFloat log2_t2 = logValue(signature2, chain2);
+		return ratioFromLog((log1_t1 - log1_t2) + (log2_t1 - log2_t2));
 	}
 };
\ No newline at end of file
@@ -1,21 +1,33 @@
 #pragma once
 #include "Integrand.h"
 #include "SampleAndPdf.h"
+#include "Parallel.h"
 #include <string>
+#include <iostream>
+#include <stdexcept>
+#include <memory>
 
 constexpr uint32_t MCMC_BURN_PERIOD = 1000;
 
-template<uint32_t TDimension>
+template<uint32_t TDimension, typename TFloat = Float>
 class Algorithm {
 protected:
-	const Integrand<TDimension>& mIntegrand;
+	static constexpr uint32_t FIRST_FREE_GENERATOR = 1 + PcgLanes::LANES;
+	static_assert(FIRST_FREE_GENERATOR < PCG_GENERATORS, "The generators of a chain do not fit its block");
+	const Integrand<TDimension, TFloat>& mIntegrand;
 	Pcg mRandom;
+	PcgLanes mRandomLanes; // Bulk generation of whole random vectors
+private:
+	std::unique_ptr<ThreadPool> mOwnPool; // Created by the first run that needs it
+	uint32_t mThreadCount; // Of the own pool, one for none
+	ThreadPool* mLentPool;
+	bool mLent;
 public:
-	INLINE Algorithm(const Integrand<TDimension>& integrand):
-		mIntegrand(integrand) {
-		mRandom = Pcg(0xDEAD, 1);
+	INLINE Algorithm(const Integrand<TDimension, TFloat>& integrand):
+		mIntegrand(integrand), mThreadCount(1), mLentPool(nullptr), mLent(false) {
+		seed(Pcg(0xDEAD));
 	}
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) = 0;
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) = 0;
 
 	virtual std::string name() const = 0;
 
@@ -23,5 +35,61 @@ public:
 
 	virtual void printStats() const {};
 
+	// Resets the random generators from the substream of one run (2^PCG_RUN_STREAM numbers), so the next run depends only on it.
+	// The first chain block of the run belongs to the algorithm: mRandom, the lanes and then FIRST_FREE_GENERATOR onwards
+	virtual void seed(const Pcg& stream) {
+		mRandom = stream.stream(0, PCG_GENERATOR_STREAM);
+		mRandomLanes.reset(stream, 1, PCG_GENERATOR_STREAM);
+	}
+
+	// Accumulates the statistics (acceptance rates, swaps, ...) of another instance of the same algorithm
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>&) {}
+
+	// Lends a pool to an algorithm created with more than one thread until restorePool, nullptr runs it on the calling
+	// thread. Single threaded algorithms stay so. TestSuite lends its pool to a single run and none to parallel runs, so
+	// the threads of the runs and of the algorithms are never multiplied
+	virtual void setPool(ThreadPool* pool) {
+		if (mThreadCount != 1) {
+			mLentPool = pool;
+			mLent = true;
+		}
+	}
+
+	// Back to the own pool
+	virtual void restorePool() {
+		mLentPool = nullptr;
+		mLent = false;
+	}
+
 	virtual ~Algorithm() {}
+protected:
+	// Block of the run stream that belongs to one chain
+	INLINE static Pcg chainStream(const Pcg& stream, const uint32_t chainNo) {
+		assert(chainNo < PCG_MAX_CHAINS);
+		return stream.stream(1 + chainNo, PCG_CHAIN_STREAM);
+	}
+
+	// For the constructors of the parallel algorithms: more than one thread gets an own pool. Zero means all hardware threads,
+	// which is meant for one run at a time
+	void setThreadCount(const uint32_t threadCount) {
+		mThreadCount = threadCount;
+	}
+
+	// Of the parallel parts of a run, nullptr runs them on the calling thread
+	ThreadPool* pool() {
+		if (mLent) {
+			return mLentPool;
+		}
+		if (mThreadCount != 1 && !mOwnPool) {
+			mOwnPool.reset(new ThreadPool(mThreadCount));
+		}
+		return mOwnPool.get();
+	}
+
+	// In release builds too, more chains than the blocks of a run would take the numbers of the next run
+	static void checkChainCount(const size_t chainCount) {
+		if (chainCount > PCG_MAX_CHAINS) {
+			throw std::invalid_argument("At most " + std::to_string(PCG_MAX_CHAINS) + " chains fit the random stream of a run");
+		}
+	}
 };
\ No newline at end of file
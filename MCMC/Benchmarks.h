@@ -0,0 +1,538 @@
+#pragma once
+#include "Integrand.h"
+#include "Utils.h"
+#include "LocalMutation.h"
+#include "PermutationSampler.h"
+#include "PermutationWalk.h"
+#include "minmaxheap.h"
+#include "OrderStatisticTree.h"
+#include "ReferenceAlgorithm.h"
+#include "UniformAlgorithm.h"
+#include "HaltonAlgorithm.h"
+#include "MetropolisHastings.h"
+#include "ParallelTempering.h"
+#include "EEM.h"
+#include "Permutations.h"
+#include "SampledSwaps.h"
+#include "AdaptiveEES.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Compares evaluating a state temperature by temperature with the batched evaluation of all temperatures
+template<uint32_t TDimension>
+void benchmarkAllTemperatures(const uint32_t temperatureCount, const uint32_t stateCount, const uint32_t modeCount = 10) {
+	const Integrand<TDimension> integrand(randomMixture<TDimension>(modeCount, 1.f, 1.f, 0.0001f, 10.f, 13370));
+	std::vector<Float> invTemperatures;
+	const Float diffTemp = pow(Float(2500), Float(1) / std::max(1u, temperatureCount - 1));
+	Float t(1);
+	for (uint32_t i = 0; i < temperatureCount; ++i) {
+		invTemperatures.push_back(1 / t);
+		t *= diffTemp;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Vector<TDimension>> states(stateCount);
+	for (Vector<TDimension>& state : states) {
+		state = randomVector<TDimension>(random);
+	}
+	std::vector<Float> values(temperatureCount);
+	// Accumulated so the compiler cannot drop the evaluations
+	Float checksumSingle(0), checksumBatched(0);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const Vector<TDimension>& state : states) {
+		for (uint32_t i = 0; i < temperatureCount; ++i) {
+			values[i] = integrand.value(state, invTemperatures[i]);
+		}
+		checksumSingle += values[temperatureCount - 1];
+	}
+	const double single = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const Vector<TDimension>& state : states) {
+		integrand.valueAllTemperatures(state, invTemperatures, values);
+		checksumBatched += values[temperatureCount - 1];
+	}
+	const double batched = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	const double evaluations = double(stateCount) * temperatureCount;
+	std::cout << "Dimension " << TDimension << ", " << modeCount << " modes, " << temperatureCount << " temperatures: "
+		<< single / evaluations << " ns/eval per temperature, " << batched / evaluations << " ns/eval batched, speedup "
+		<< single / batched << "x (checksum " << checksumSingle - checksumBatched << ")" << std::endl;
+}
+
+// Compares random vectors generated coordinate by coordinate with the bulk fill of the multi-lane generator
+template<uint32_t TDimension>
+void benchmarkRandomVectors(const uint32_t vectorCount) {
+	Pcg random(0xBEEF, 0xCAFE);
+	PcgLanes randomLanes(0xBEEF, 0xCAFE);
+	// Accumulated so the compiler cannot drop the generation
+	Vector<TDimension> checksumScalar(Float(0)), checksumLanes(Float(0));
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < vectorCount; ++i) {
+		checksumScalar += randomVector<TDimension>(random);
+	}
+	const double scalar = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < vectorCount; ++i) {
+		checksumLanes += randomVector<TDimension>(randomLanes);
+	}
+	const double lanes = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Dimension " << TDimension << " random vectors: " << scalar / vectorCount << " ns/vector scalar, "
+		<< lanes / vectorCount << " ns/vector " << PcgLanes::LANES << " lanes, speedup " << scalar / lanes << "x (mean "
+		<< checksumScalar[0] / vectorCount << " / " << checksumLanes[0] / vectorCount << ")" << std::endl;
+}
+
+// Compares the batched evaluation in float with double on the same mixture: the time per evaluation, the largest
+// error of the float log values and the error of the float estimate of the integral over the unit cube
+template<uint32_t TDimension>
+void benchmarkPrecision(const uint32_t temperatureCount, const uint32_t stateCount, const uint32_t modeCount = 10) {
+	const Integrand<TDimension, double> integrandDouble(randomMixture<TDimension, double>(modeCount, 1.f, 1.f, 0.0001f, 10.f, 13370));
+	const Integrand<TDimension, float> integrandFloat(randomMixture<TDimension, float>(modeCount, 1.f, 1.f, 0.0001f, 10.f, 13370));
+	std::vector<double> invTemperaturesDouble;
+	std::vector<float> invTemperaturesFloat;
+	const double diffTemp = pow(2500.0, 1.0 / std::max(1u, temperatureCount - 1));
+	double t(1);
+	for (uint32_t i = 0; i < temperatureCount; ++i) {
+		invTemperaturesDouble.push_back(1 / t);
+		invTemperaturesFloat.push_back(float(1 / t));
+		t *= diffTemp;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Vector<TDimension, double>> statesDouble(stateCount);
+	std::vector<Vector<TDimension, float>> statesFloat(stateCount);
+	for (uint32_t s = 0; s < stateCount; ++s) {
+		statesFloat[s] = randomVector<TDimension, float>(random);
+		for (uint32_t d = 0; d < TDimension; ++d) {
+			statesDouble[s][d] = statesFloat[s][d];
+		}
+	}
+	std::vector<double> logValuesDouble(size_t(stateCount) * temperatureCount);
+	std::vector<float> logValuesFloat(size_t(stateCount) * temperatureCount);
+	typename Integrand<TDimension, double>::StateSignature signatureDouble;
+	typename Integrand<TDimension, float>::StateSignature signatureFloat;
+	std::vector<double> valuesDouble;
+	std::vector<float> valuesFloat;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t s = 0; s < stateCount; ++s) {
+		integrandDouble.signature(statesDouble[s], signatureDouble);
+		integrandDouble.logValueAllTemperatures(signatureDouble, invTemperaturesDouble, valuesDouble);
+		std::copy(valuesDouble.begin(), valuesDouble.end(), logValuesDouble.begin() + size_t(s) * temperatureCount);
+	}
+	const double timeDouble = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	for (uint32_t s = 0; s < stateCount; ++s) {
+		integrandFloat.signature(statesFloat[s], signatureFloat);
+		integrandFloat.logValueAllTemperatures(signatureFloat, invTemperaturesFloat, valuesFloat);
+		std::copy(valuesFloat.begin(), valuesFloat.end(), logValuesFloat.begin() + size_t(s) * temperatureCount);
+	}
+	const double timeFloat = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// Errors of the values that matter, the ones far below the largest value do not change the estimates
+	double maxLogError(0), integralDouble(0), integralFloat(0);
+	for (uint32_t s = 0; s < stateCount; ++s) {
+		for (uint32_t i = 0; i < temperatureCount; ++i) {
+			const double logDouble = logValuesDouble[size_t(s) * temperatureCount + i];
+			if (logDouble > -80) {
+				maxLogError = std::max(maxLogError, std::abs(logDouble - logValuesFloat[size_t(s) * temperatureCount + i]));
+			}
+		}
+		integralDouble += exp(logValuesDouble[size_t(s) * temperatureCount]);
+		integralFloat += exp(double(logValuesFloat[size_t(s) * temperatureCount]));
+	}
+
+	const double evaluations = double(stateCount) * temperatureCount;
+	std::cout << "Dimension " << TDimension << ", " << modeCount << " modes, " << temperatureCount << " temperatures: "
+		<< timeDouble / evaluations << " ns/eval double, " << timeFloat / evaluations << " ns/eval float, speedup "
+		<< timeDouble / timeFloat << "x, max log error " << maxLogError << ", integral error "
+		<< std::abs(integralFloat / integralDouble - 1) << std::endl;
+}
+
+struct BenchmarkOptions {
+	std::string filter; // Only the cases whose name contains it
+	double minMilliseconds = 20; // Every case is repeated for at least this long
+
+	INLINE bool enabled(const std::string& name) const {
+		return name.find(filter) != std::string::npos;
+	}
+};
+
+// The checksums of the cases end up here, so the compiler cannot drop the timed calls
+inline volatile double gBenchmarkSink = 0;
+
+// One CSV line per case: case,dimension,modes,size,ns_per_op (zero where the parameter does not apply)
+INLINE void reportBenchmark(const std::string& name, const uint32_t dimension, const uint32_t modes, const uint32_t size, const double nanoseconds) {
+	std::cout << name << "," << dimension << "," << modes << "," << size << "," << nanoseconds << std::endl;
+}
+
+// Doubles the repetitions of op(i) until they take at least the minimal time
+template<typename TOp>
+double nanosecondsPerOp(const BenchmarkOptions& options, TOp op) {
+	for (uint64_t count = 1;; count *= 2) {
+		double checksum(0);
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < count; ++i) {
+			checksum += op(i);
+		}
+		const double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		gBenchmarkSink = gBenchmarkSink + checksum;
+		if (elapsed >= options.minMilliseconds * 1e6) {
+			return elapsed / count;
+		}
+	}
+}
+
+INLINE void benchmarkPcg(const BenchmarkOptions& options) {
+	if (options.enabled("pcg_uint")) {
+		Pcg random(0xBEEF, 0xCAFE);
+		reportBenchmark("pcg_uint", 0, 0, 0, nanosecondsPerOp(options, [&random](uint64_t) { return double(random.uint()); }));
+	}
+}
+
+// The temperature matrix of size x size chains is random, the sampler fills the whole subset table for every sample
+INLINE void benchmarkPermutationSampler(const uint32_t size, const BenchmarkOptions& options, const uint32_t threadCount = 1) {
+	const std::string name = threadCount == 1 ? "permutation_sample" : "permutation_sample_threaded";
+	if (!options.enabled(name)) {
+		return;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Float> values(size * size);
+	for (Float& v : values) {
+		v = Float(1) - random();
+	}
+	PermutationSampler sampler(size, false, threadCount);
+	const auto functor = [&values, size](const uint32_t chainBefore, const uint32_t chainAfter) {
+		return values[chainBefore * size + chainAfter];
+	};
+	reportBenchmark(name, 0, 0, size, nanosecondsPerOp(options, [&](uint64_t) {
+		Float count;
+		sampler.sample(functor, random(), count);
+		return double(sampler.permutation()[0]) + count;
+	}));
+}
+
+// Same matrices as benchmarkPermutationSampler, the walk makes two proposals per chain like PermutationsAlgorithm
+INLINE void benchmarkPermutationWalk(const uint32_t size, const BenchmarkOptions& options) {
+	if (!options.enabled("permutation_walk")) {
+		return;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Float> logValues(size * size);
+	for (Float& v : logValues) {
+		v = log(Float(1) - random());
+	}
+	PermutationWalk walk(size);
+	const auto functor = [&logValues, size](const uint32_t chainBefore, const uint32_t chainAfter) {
+		return logValues[chainBefore * size + chainAfter];
+	};
+	reportBenchmark("permutation_walk", 0, 0, size, nanosecondsPerOp(options, [&](uint64_t) {
+		return double(walk.sample(functor, random, 2 * size)[0]);
+	}));
+}
+
+// The phases are timed separately: size adds into an empty heap, size removals of the minimum and of the maximum, and
+// a bulk build of the same values (reported per element)
+INLINE void benchmarkHeap(const uint32_t size, const BenchmarkOptions& options) {
+	if (!options.enabled("heap_")) {
+		return;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Float> values(size);
+	for (Float& v : values) {
+		v = random();
+	}
+	Heap<Float> heap;
+	double add(0), removeMin(0), removeMax(0), build(0);
+	uint64_t rounds = 0;
+	const auto elapsed = [](const std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	};
+	while (std::min(std::min(add, build), std::min(removeMin, removeMax)) < options.minMilliseconds * 1e6) {
+		auto start = std::chrono::steady_clock::now();
+		for (const Float v : values) {
+			heap.add(v);
+		}
+		add += elapsed(start);
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < size; ++i) {
+			heap.remove_min();
+		}
+		removeMin += elapsed(start);
+		for (const Float v : values) {
+			heap.add(v);
+		}
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < size; ++i) {
+			heap.remove_max();
+		}
+		removeMax += elapsed(start);
+		start = std::chrono::steady_clock::now();
+		heap.build(values.begin(), values.end());
+		build += elapsed(start);
+		gBenchmarkSink = gBenchmarkSink + heap.maximum();
+		heap.clear();
+		++rounds;
+	}
+	const double operations = double(rounds) * size;
+	reportBenchmark("heap_add", 0, 0, size, add / operations);
+	reportBenchmark("heap_remove_min", 0, 0, size, removeMin / operations);
+	reportBenchmark("heap_remove_max", 0, 0, size, removeMax / operations);
+	reportBenchmark("heap_build", 0, 0, size, build / operations);
+}
+
+// Like benchmarkHeap: size adds into an empty tree, size rank queries, size lookups by rank and size removals at
+// uniform ranks
+INLINE void benchmarkOrderStatisticTree(const uint32_t size, const BenchmarkOptions& options) {
+	if (!options.enabled("rank_tree_")) {
+		return;
+	}
+	Pcg random(0xBEEF, 0xCAFE);
+	std::vector<Float> values(size);
+	for (Float& v : values) {
+		v = random();
+	}
+	OrderStatisticTree<Float> tree;
+	double add(0), rank(0), get(0), remove(0), sink(0);
+	uint64_t rounds = 0;
+	const auto elapsed = [](const std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	};
+	while (std::min(std::min(add, rank), std::min(get, remove)) < options.minMilliseconds * 1e6) {
+		auto start = std::chrono::steady_clock::now();
+		for (const Float v : values) {
+			tree.add(v);
+		}
+		add += elapsed(start);
+		start = std::chrono::steady_clock::now();
+		for (const Float v : values) {
+			sink += Float(tree.lowerRank(v));
+		}
+		rank += elapsed(start);
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < size; ++i) {
+			sink += tree.get(std::min(size_t(values[i] * size), size_t(size - 1)));
+		}
+		get += elapsed(start);
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < size; ++i) {
+			tree.removeAt(std::min(size_t(values[i] * (size - i)), size_t(size - i - 1)));
+		}
+		remove += elapsed(start);
+		++rounds;
+	}
+	gBenchmarkSink = gBenchmarkSink + sink;
+	const double operations = double(rounds) * size;
+	reportBenchmark("rank_tree_add", 0, 0, size, add / operations);
+	reportBenchmark("rank_tree_rank", 0, 0, size, rank / operations);
+	reportBenchmark("rank_tree_get", 0, 0, size, get / operations);
+	reportBenchmark("rank_tree_remove", 0, 0, size, remove / operations);
+}
+
+// A step advances every chain once, the runs without a burn-in period take a step per sample
+template<uint32_t TDimension>
+void benchmarkAlgorithmStep(const BenchmarkOptions& options, const std::string& name, const uint32_t modes, const uint32_t chainCount,
+	Algorithm<TDimension>&& algorithm, const bool burnIn) {
+	if (!options.enabled(name)) {
+		return;
+	}
+	std::vector<SampleAndPdf<TDimension>> samples(1000);
+	const uint32_t steps = uint32_t(samples.size()) + (burnIn ? MCMC_BURN_PERIOD : 0);
+	const double run = nanosecondsPerOp(options, [&](uint64_t) {
+		algorithm.run(samples);
+		return samples.back().pdf;
+	});
+	reportBenchmark(name, TDimension, modes, chainCount, run / steps);
+}
+
+template<uint32_t TDimension>
+void benchmarkSuiteDimension(const BenchmarkOptions& options) {
+	if (options.enabled("mutate_state")) {
+		Pcg random(0xBEEF, 0xCAFE);
+		LocalMutation<TDimension> mutator(random);
+		mutator.setState(randomVector<TDimension>(random), Float(0));
+		mutator.startAdaptation(0.3f);
+		reportBenchmark("mutate_state", TDimension, 0, 0, nanosecondsPerOp(options, [&mutator](uint64_t) { return mutator.mutateState()[0]; }));
+	}
+	std::vector<Float> temperatures;
+	const Float diffTemp = pow(Float(2500), Float(1) / 7);
+	Float t(1);
+	for (uint32_t i = 0; i < 8; ++i) {
+		temperatures.push_back(t);
+		t *= diffTemp;
+	}
+	const uint32_t chains = uint32_t(temperatures.size());
+	for (const uint32_t modes : { 10u, 100u, 1000u }) {
+		const Integrand<TDimension> integrand(randomMixture<TDimension>(modes, 1.f, 1.f, 0.0001f, 10.f, 13370));
+		// Fixed sets of states and random numbers, so the cases do not time the generator
+		Pcg random(0xBEEF, 0xCAFE);
+		std::vector<Vector<TDimension>> points(1024);
+		for (Vector<TDimension>& p : points) {
+			p = randomVector<TDimension>(random);
+		}
+		if (options.enabled("integrand_value")) {
+			reportBenchmark("integrand_value", TDimension, modes, 0, nanosecondsPerOp(options, [&](const uint64_t i) {
+				return integrand.value(points[i & 1023], Float(1));
+			}));
+		}
+		if (options.enabled("mixture_sample")) {
+			reportBenchmark("mixture_sample", TDimension, modes, 0, nanosecondsPerOp(options, [&](const uint64_t i) {
+				return integrand.getDistribution().sample(points[i & 1023])[0];
+			}));
+		}
+		benchmarkAlgorithmStep<TDimension>(options, "step_reference", modes, 1, ReferenceAlgorithm<TDimension>(integrand), false);
+		benchmarkAlgorithmStep<TDimension>(options, "step_uniform", modes, 1, UniformAlgorithm<TDimension>(integrand), false);
+		benchmarkAlgorithmStep<TDimension>(options, "step_halton", modes, 1, HaltonAlgorithm<TDimension>(integrand), false);
+		benchmarkAlgorithmStep<TDimension>(options, "step_metropolis_hastings", modes, 1, MetropolisHastingsAlgorithm<TDimension>(integrand), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_parallel_tempering", modes, chains, ParallelTemperingAlgorithm<TDimension>(integrand, temperatures), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_parallel_tempering_deo", modes, chains,
+			ParallelTemperingAlgorithm<TDimension>(integrand, temperatures, ParallelTemperingType::DEO), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_eem_original", modes, chains,
+			EquiEnergyMovesAlgorithm<TDimension>(integrand, temperatures, 8, EquiEnergyMovesType::ORIGINAL), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_eem_frequent_fallback", modes, chains,
+			EquiEnergyMovesAlgorithm<TDimension>(integrand, temperatures, 8, EquiEnergyMovesType::FREQUENT_FALLBACK), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_permutations_all", modes, chains,
+			PermutationsAlgorithm<TDimension>(integrand, temperatures, PermutationsType::ALL), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_permutations_non_identity", modes, chains,
+			PermutationsAlgorithm<TDimension>(integrand, temperatures, PermutationsType::NON_IDENTITY), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_permutations_metropolis", modes, chains,
+			PermutationsAlgorithm<TDimension>(integrand, temperatures, PermutationsType::METROPOLIS), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_sampled_swaps", modes, chains, SampledSwapsAlgorithm<TDimension>(integrand, temperatures), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_aees_adaptive", modes, chains,
+			AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ADAPTIVE), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_aees_original", modes, chains,
+			AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ORIGINAL), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_aees_pipelined", modes, chains,
+			AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ADAPTIVE, EESSchedule::PIPELINED), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_aees_reservoir", modes, chains,
+			AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ADAPTIVE, EESSchedule::CHAIN_BY_CHAIN, 1, 1024), true);
+		benchmarkAlgorithmStep<TDimension>(options, "step_aees_sketch", modes, chains,
+			AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::SKETCH, EESSchedule::CHAIN_BY_CHAIN, 1, 1024), true);
+	}
+}
+
+// Time per step of a threaded sampler from one thread to all hardware threads (the size column is the thread count),
+// every thread count has to give the samples of one thread. The factory makes the algorithm for a thread count
+template<uint32_t TDimension, typename TFactory>
+void benchmarkThreadScaling(const BenchmarkOptions& options, const std::string& name, const uint32_t temperatureCount, const uint32_t modes,
+	const TFactory& factory) {
+	if (!options.enabled(name)) {
+		return;
+	}
+	const Integrand<TDimension> integrand(randomMixture<TDimension>(modes, 1.f, 1.f, 0.0001f, 10.f, 13370));
+	std::vector<Float> temperatures;
+	const Float diffTemp = pow(Float(2500), Float(1) / std::max(1u, temperatureCount - 1));
+	Float t(1);
+	for (uint32_t i = 0; i < temperatureCount; ++i) {
+		temperatures.push_back(t);
+		t *= diffTemp;
+	}
+	const uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+	std::vector<SampleAndPdf<TDimension>> reference;
+	for (const uint32_t threads : threadCounts) {
+		const std::unique_ptr<Algorithm<TDimension>> algorithm = factory(integrand, temperatures, threads);
+		std::vector<SampleAndPdf<TDimension>> samples(1000);
+		const double run = nanosecondsPerOp(options, [&](uint64_t) {
+			algorithm->seed(Pcg(0xDEAD));
+			algorithm->run(samples);
+			return samples.back().pdf;
+		});
+		if (reference.empty()) {
+			reference = samples;
+		}
+		for (uint32_t i = 0; i < uint32_t(samples.size()); ++i) {
+			if (samples[i].pdf != reference[i].pdf) {
+				std::cerr << name << ": the samples of " << threads << " threads differ from one thread" << std::endl;
+				break;
+			}
+		}
+		reportBenchmark(name, TDimension, modes, threads, run / (uint32_t(samples.size()) + MCMC_BURN_PERIOD));
+	}
+}
+
+template<uint32_t TDimension>
+void benchmarkParallelTemperingScaling(const BenchmarkOptions& options, const uint32_t temperatureCount, const uint32_t modes) {
+	benchmarkThreadScaling<TDimension>(options, "pt_deo_scaling", temperatureCount, modes,
+		[](const Integrand<TDimension>& integrand, const std::vector<Float>& temperatures, const uint32_t threads) {
+			return std::unique_ptr<Algorithm<TDimension>>(new ParallelTemperingAlgorithm<TDimension>(integrand, temperatures, ParallelTemperingType::DEO, threads));
+		});
+}
+
+// The chain by chain schedule is the baseline, the pipelined one should approach its time divided by the chain count
+template<uint32_t TDimension>
+void benchmarkAdaptiveEESPipeline(const BenchmarkOptions& options, const uint32_t temperatureCount, const uint32_t modes) {
+	benchmarkThreadScaling<TDimension>(options, "aees_chain_by_chain", temperatureCount, modes,
+		[](const Integrand<TDimension>& integrand, const std::vector<Float>& temperatures, const uint32_t) {
+			return std::unique_ptr<Algorithm<TDimension>>(new AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ADAPTIVE));
+		});
+	benchmarkThreadScaling<TDimension>(options, "aees_pipelined_scaling", temperatureCount, modes,
+		[](const Integrand<TDimension>& integrand, const std::vector<Float>& temperatures, const uint32_t threads) {
+			return std::unique_ptr<Algorithm<TDimension>>(new AdaptiveEESAlgorithm<TDimension>(integrand, temperatures, 16, Float(0.1f), EESType::ADAPTIVE,
+				EESSchedule::PIPELINED, threads));
+		});
+}
+
+// Steps of the multi-chain swaps on a geometric ladder of temperatureCount chains (the size column), the exact subset table
+// only up to 20 chains
+template<uint32_t TDimension>
+void benchmarkSwapLadder(const BenchmarkOptions& options, const uint32_t temperatureCount, const uint32_t modes) {
+	const Integrand<TDimension> integrand(randomMixture<TDimension>(modes, 1.f, 1.f, 0.0001f, 10.f, 13370));
+	std::vector<Float> temperatures;
+	const Float diffTemp = pow(Float(2500), Float(1) / std::max(1u, temperatureCount - 1));
+	Float t(1);
+	for (uint32_t i = 0; i < temperatureCount; ++i) {
+		temperatures.push_back(t);
+		t *= diffTemp;
+	}
+	if (temperatureCount <= 20) {
+		benchmarkAlgorithmStep<TDimension>(options, "ladder_permutations_all", modes, temperatureCount,
+			PermutationsAlgorithm<TDimension>(integrand, temperatures, PermutationsType::ALL), true);
+	}
+	benchmarkAlgorithmStep<TDimension>(options, "ladder_permutations_metropolis", modes, temperatureCount,
+		PermutationsAlgorithm<TDimension>(integrand, temperatures, PermutationsType::METROPOLIS), true);
+	benchmarkAlgorithmStep<TDimension>(options, "ladder_sampled_swaps", modes, temperatureCount, SampledSwapsAlgorithm<TDimension>(integrand, temperatures), true);
+}
+
+// Hot paths of the samplers over dimensions 2 to 14 and 10 to 1000 modes
+INLINE void runBenchmarkSuite(const BenchmarkOptions& options) {
+	std::cout << "case,dimension,modes,size,ns_per_op" << std::endl;
+	benchmarkPcg(options);
+	for (const uint32_t size : { 4u, 8u, 12u, 16u, 20u }) {
+		benchmarkPermutationSampler(size, options);
+	}
+	for (const uint32_t size : { 16u, 20u, 24u }) {
+		benchmarkPermutationSampler(size, options, 0);
+	}
+	for (const uint32_t size : { 4u, 8u, 12u, 16u, 20u, 64u }) {
+		benchmarkPermutationWalk(size, options);
+	}
+	for (const uint32_t size : { 1000u, 100000u }) {
+		benchmarkHeap(size, options);
+		benchmarkOrderStatisticTree(size, options);
+	}
+	benchmarkSuiteDimension<2>(options);
+	benchmarkSuiteDimension<4>(options);
+	benchmarkSuiteDimension<6>(options);
+	benchmarkSuiteDimension<8>(options);
+	benchmarkSuiteDimension<10>(options);
+	benchmarkSuiteDimension<12>(options);
+	benchmarkSuiteDimension<14>(options);
+	benchmarkParallelTemperingScaling<8>(options, 32, 100);
+	benchmarkParallelTemperingScaling<8>(options, 32, 1000);
+	benchmarkAdaptiveEESPipeline<8>(options, 8, 100);
+	benchmarkAdaptiveEESPipeline<8>(options, 8, 1000);
+	for (const uint32_t temperatureCount : { 8u, 16u, 20u, 64u }) {
+		benchmarkSwapLadder<8>(options, temperatureCount, 100);
+	}
+}
@@ -25,9 +25,9 @@ public:
 	}
 
 	INLINE void set(const uint32_t x, const uint32_t y, const Rgb& value) {
-		mImage(x, y, 0, 0) = unsigned char(value[0] * 255.f);
-		mImage(x, y, 0, 1) = unsigned char(value[1] * 255.f);
-		mImage(x, y, 0, 2) = unsigned char(value[2] * 255.f);
+		mImage(x, y, 0, 0) = static_cast<unsigned char>(value[0] * 255.f);
+		mImage(x, y, 0, 1) = static_cast<unsigned char>(value[1] * 255.f);
+		mImage(x, y, 0, 2) = static_cast<unsigned char>(value[2] * 255.f);
 	}
 
 	INLINE void save(const char * filePath) const {
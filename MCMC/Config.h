@@ -5,5 +5,10 @@
 #include <cassert>
 #include <algorithm>
 
+#if defined(_MSC_VER)
 #define INLINE __forceinline
-#define Float double
\ No newline at end of file
+#else
+#define INLINE inline __attribute__((always_inline))
+#endif
+// Default precision, the integrand and the algorithms take theirs as a template parameter
+using Float = double;
\ No newline at end of file
@@ -7,25 +7,91 @@ enum class EquiEnergyMovesType {
 	FREQUENT_FALLBACK = 1
 };
 
-template<uint32_t TDimension>
-class EquiEnergyMovesAlgorithm : public Algorithm<TDimension> {
+template<uint32_t TDimension, typename TFloat = Float>
+class EquiEnergyMovesAlgorithm : public Algorithm<TDimension, TFloat> {
+	using Signature = typename Integrand<TDimension, TFloat>::StateSignature;
 	struct Chain {
-		LocalMutation<TDimension>* mutator;
-		Float invTemperature;
+		LocalMutation<TDimension, TFloat>* mutator;
+		TFloat invTemperature;
 		Pcg random;
+		PcgLanes randomLanes; // Large steps
 		int swapAttempts, swaps;
-		std::vector<Float> levels;
+		Signature signature, proposedSignature; // Current state and the scratch space for proposals
+		std::vector<TFloat> values; // Value of the current state at the temperatures of all chains
+		std::vector<TFloat> levels; // Multiples of the spacing
+		TFloat levelSpacing;
+	};
+	// Which chains have their states in which ring at the levels of one temperature, every update and query is O(1)
+	class RingOccupancy {
+		std::vector<std::vector<uint32_t>> mMembers; // Chains of every ring
+		std::vector<uint32_t> mRing, mPosition; // Ring of every chain and its index in the members of that ring
+		std::vector<uint32_t> mUsable, mUsablePosition; // Rings with at least two chains, and their index in mUsable
+	public:
+		INLINE void reset(const uint32_t ringCount, const uint32_t chainCount) {
+			mMembers.assign(ringCount, std::vector<uint32_t>());
+			mRing.assign(chainCount, ringCount);
+			mPosition.assign(chainCount, 0);
+			mUsable.clear();
+			mUsablePosition.assign(ringCount, 0);
+		}
+
+		INLINE void move(const uint32_t chain, const uint32_t ring) {
+			const uint32_t old = mRing[chain];
+			if (old == ring) {
+				return;
+			}
+			if (old < uint32_t(mMembers.size())) {
+				std::vector<uint32_t>& members = mMembers[old];
+				const uint32_t last = members.back();
+				members[mPosition[chain]] = last;
+				mPosition[last] = mPosition[chain];
+				members.pop_back();
+				if (members.size() == 1) {
+					const uint32_t lastUsable = mUsable.back();
+					mUsable[mUsablePosition[old]] = lastUsable;
+					mUsablePosition[lastUsable] = mUsablePosition[old];
+					mUsable.pop_back();
+				}
+			}
+			mRing[chain] = ring;
+			mPosition[chain] = uint32_t(mMembers[ring].size());
+			mMembers[ring].push_back(chain);
+			if (mMembers[ring].size() == 2) {
+				mUsablePosition[ring] = uint32_t(mUsable.size());
+				mUsable.push_back(ring);
+			}
+		}
+
+		// The states of the chains are exchanged, so are their rings
+		INLINE void swap(const uint32_t chain1, const uint32_t chain2) {
+			const uint32_t ring1 = mRing[chain1];
+			if (ring1 != mRing[chain2]) {
+				mMembers[ring1][mPosition[chain1]] = chain2;
+				mMembers[mRing[chain2]][mPosition[chain2]] = chain1;
+				std::swap(mPosition[chain1], mPosition[chain2]);
+				std::swap(mRing[chain1], mRing[chain2]);
+			}
+		}
+
+		INLINE uint32_t ring(const uint32_t chain) const { return mRing[chain]; }
+		INLINE uint32_t size(const uint32_t ring) const { return uint32_t(mMembers[ring].size()); }
+		INLINE uint32_t member(const uint32_t ring, const uint32_t index) const { return mMembers[ring][index]; }
+		INLINE uint32_t usableCount() const { return uint32_t(mUsable.size()); }
+		INLINE uint32_t usable(const uint32_t index) const { return mUsable[index]; }
 	};
-	std::vector<Float> levels;
 	std::vector<Chain> chains;
-	Float mLargeStepProb;
+	// ORIGINAL tracks the rings at the first temperature, FREQUENT_FALLBACK at the temperatures of all chains
+	std::vector<RingOccupancy> mOccupancy;
+	std::vector<TFloat> invTemperatures; // Of all chains, for the batched evaluation
+	TFloat mLargeStepProb;
 	EquiEnergyMovesType mType;
 	int mRingCount;
 	int movesPossible, movesAttempts;
 	Pcg random;
 public:
-	INLINE EquiEnergyMovesAlgorithm(const Integrand<TDimension>& integrand, std::vector<Float> temperatures, const int ringCount, const EquiEnergyMovesType type) : 
-		Algorithm<TDimension>(integrand), mType(type), mRingCount(ringCount) {
+	INLINE EquiEnergyMovesAlgorithm(const Integrand<TDimension, TFloat>& integrand, std::vector<Float> temperatures, const int ringCount, const EquiEnergyMovesType type) : 
+		Algorithm<TDimension, TFloat>(integrand), mType(type), mRingCount(ringCount) {
+		this->checkChainCount(temperatures.size());
 		mLargeStepProb = 0.3f;
 		std::sort(temperatures.begin(), temperatures.end());
 		assert(temperatures.size() > 0 && temperatures[0] == 1.f);
@@ -33,16 +99,16 @@ public:
 		chains.resize(temperatures.size());
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			chains[i].invTemperature = 1.f / temperatures[i];
-			chains[i].random.reset(1337 * i + 235, 1579 * i + 454);
-			chains[i].mutator = new LocalMutation<TDimension>(chains[i].random);
+			invTemperatures.push_back(chains[i].invTemperature);
+			chains[i].mutator = new LocalMutation<TDimension, TFloat>(chains[i].random);
 			chains[i].swapAttempts = 0;
 			chains[i].swaps = 0;
-			computeLevels(chains[i].levels, integrand.maxValue(chains[i].invTemperature));
+			computeLevels(chains[i].levels, chains[i].levelSpacing, integrand.maxValue(chains[i].invTemperature));
 		}
-		random.reset(0xDEAD, 0xDEAD);
+		mOccupancy.resize(mType == EquiEnergyMovesType::ORIGINAL ? 1 : chains.size());
+		seed(Pcg(0xDEAD));
 		movesPossible = 0;
 		movesAttempts = 0;
-		computeLevels(levels, integrand.maxValue(Float(1)));
 	}
 
 	virtual ~EquiEnergyMovesAlgorithm() override {
@@ -51,27 +117,39 @@ public:
 		}
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			do {
-				chains[i].mutator->setState(randomVector<TDimension>(chains[i].random));
-			} while (value(chains[i].mutator->getState(), i) == Float(0));
+				const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(chains[i].random);
+				chains[i].mutator->setState(state, logValue(state, i));
+			} while (exp(chains[i].mutator->getLogValue()) == TFloat(0)); // Start where the value does not underflow
 			chains[i].mutator->startAdaptation(0.3f);
+			this->mIntegrand.signature(chains[i].mutator->getState(), chains[i].signature);
+			this->mIntegrand.valueAllTemperatures(chains[i].signature, invTemperatures, chains[i].values);
+		}
+		for (RingOccupancy& occupancy : mOccupancy) {
+			occupancy.reset(mRingCount, uint32_t(chains.size()));
+		}
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			updateRings(i);
 		}
-		std::vector<int> ringHits(mRingCount);
-		std::vector<int> chainHits(chains.size());
 		for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
 			for (int c = int(chains.size()) - 1; c >= 0; --c) {
 				const bool localStep = i % 3 != 0;
-				Vector<TDimension> proposed;
+				Vector<TDimension, TFloat> proposed;
 				if (localStep) {
 					proposed = chains[c].mutator->mutateState();
 				}
 				else {
-					proposed = randomVector<TDimension>(chains[c].random);
+					proposed = randomVector<TDimension, TFloat>(chains[c].randomLanes);
 				}
-				if (acceptRatio(chains[c].mutator->getState(), proposed, c) > chains[c].random()) {
-					chains[c].mutator->mutationWasAccepted(proposed, localStep);
+				this->mIntegrand.signature(proposed, chains[c].proposedSignature);
+				const TFloat logProposed = logValue(chains[c].proposedSignature, c);
+				if (acceptRatio(c, logProposed) > chains[c].random()) {
+					chains[c].mutator->mutationWasAccepted(proposed, logProposed, localStep);
+					std::swap(chains[c].signature, chains[c].proposedSignature);
+					this->mIntegrand.valueAllTemperatures(chains[c].signature, invTemperatures, chains[c].values);
+					updateRings(c);
 				}
 				else {
 					chains[c].mutator->mutationWasRejected(localStep);
@@ -79,119 +157,56 @@ public:
 				if (c == 0 && i >= MCMC_BURN_PERIOD) {
 					const uint32_t index = i - MCMC_BURN_PERIOD;
 					samples[index].sample = chains[c].mutator->getState();
-					samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
+					samples[index].pdf = chains[c].values[0];
 				}
 				if (mType == EquiEnergyMovesType::FREQUENT_FALLBACK) {
+					// A uniform partner among the other chains whose states are in the ring of c at its temperature
 					++movesAttempts;
-					chainHits.clear();
-					int cRing = ringNumber(chains[c].levels, value(chains[c].mutator->getState(), c));
-					for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-						if (c != c2) {
-							int c2Ring = ringNumber(chains[c].levels, value(chains[c2].mutator->getState(), c));
-							if (c2Ring == cRing) {
-								chainHits.push_back(c2);
-							}
-						}
-					}
-					if (chainHits.size() > 0) {
+					const RingOccupancy& occupancy = mOccupancy[c];
+					const uint32_t cRing = occupancy.ring(c);
+					const uint32_t chainsInRing = occupancy.size(cRing);
+					if (chainsInRing > 1) {
 						++movesPossible;
-						const int selectedChainRelative = clamp(int(random() * chainHits.size()), 0, int(chainHits.size() - 1));
-						int c2 = chainHits[selectedChainRelative];
+						const uint32_t selectedChainRelative = uint32_t(clamp(int(random() * (chainsInRing - 1)), 0, int(chainsInRing - 2)));
+						uint32_t c2 = occupancy.member(cRing, selectedChainRelative);
+						if (c2 == uint32_t(c)) {
+							c2 = occupancy.member(cRing, chainsInRing - 1);
+						}
 						++chains[c].swapAttempts;
 						++chains[c2].swapAttempts;
-						if (swapRatio(c, c2) > random()) {
+						TFloat log1_t2, log2_t1;
+						if (swapRatio(c, c2, log1_t2, log2_t1) > random()) {
 							++chains[c].swaps;
 							++chains[c2].swaps;
-							auto temp = chains[c].mutator->getState();
-							chains[c].mutator->setState(chains[c2].mutator->getState());
-							chains[c2].mutator->setState(temp);
+							swapStates(c, c2, log1_t2, log2_t1);
 						}
 					}
-					/*else {
-						// Find first friendly chain
-						for (int c2 = c + 1; c2 < chains.size(); ++c2) {
-							int c2Ring = ringNumber(chains[c2].levels, this->mIntegrand.value(chains[c2].mutator->getState()));
-							bool anyHits = false;
-							for (int c3 = int(chains.size()) - 1; c3 >= 0; --c3) {
-								if (c3 != c2) {
-									int c3Ring = ringNumber(chains[c2].levels, this->mIntegrand.value(chains[c3].mutator->getState()));
-									if (c2Ring == c3Ring) {
-										anyHits = true;
-									}
-								}
-							}
-							if (!anyHits) {
-								++chains[c].swapAttempts;
-								++chains[c2].swapAttempts;
-								if (swapRatio(c, c2) > random()) {
-									++chains[c].swaps;
-									++chains[c2].swaps;
-									auto temp = chains[c].mutator->getState();
-									chains[c].mutator->setState(chains[c2].mutator->getState());
-									chains[c2].mutator->setState(temp);
-								}
-							}
-						}
-					}*/
 				}
-				
 			}
 			if (mType == EquiEnergyMovesType::ORIGINAL) {
+				// A uniform ring with at least two chains at the first temperature, then a uniform pair in it
 				++movesAttempts;
-				for (int & hits : ringHits) {
-					hits = 0;
-				}
-				for (int c = int(chains.size()) - 1; c >= 0; --c) {
-					++ringHits[ringNumber(levels, this->mIntegrand.value(chains[c].mutator->getState(), Float(1)))];
-				}
-				int usableRingsCount = 0;
-				for (int hits : ringHits) {
-					usableRingsCount += hits > 1;
-				}
+				const RingOccupancy& occupancy = mOccupancy[0];
+				const uint32_t usableRingsCount = occupancy.usableCount();
 				if (usableRingsCount > 0) {
 					++movesPossible;
-					int selectedRingRelative = clamp(int(random() * usableRingsCount), 0, usableRingsCount - 1);
-					int selectedRing = -1;
-					for (unsigned int i = 0; i < ringHits.size(); ++i) {
-						if (ringHits[i] > 1) {
-							if (selectedRingRelative == 0) {
-								selectedRing = i;
-								break;
-							}
-							--selectedRingRelative;
-						}
-					}
-					assert(selectedRing != -1);
-					const int chainsInRing = ringHits[selectedRing];
+					const uint32_t selectedRing = occupancy.usable(uint32_t(clamp(int(random() * usableRingsCount), 0, int(usableRingsCount - 1))));
+					const int chainsInRing = int(occupancy.size(selectedRing));
 					const int selectedChain1Relative = clamp(int(random() * chainsInRing), 0, chainsInRing - 1);
 					int selectedChain2Relative = clamp(int(random() * (chainsInRing-1)), 0, chainsInRing - 2);
-					if (selectedChain1Relative == selectedChain2Relative) {
+					if (selectedChain2Relative >= selectedChain1Relative) {
 						++selectedChain2Relative;
 					}
-					int currentChainRelative = 0, chain1 = -1, chain2 = -1;
-					for (int c = int(chains.size()) - 1; c >= 0; --c) {
-						const int ringIndex = ringNumber(levels, this->mIntegrand.value(chains[c].mutator->getState(), Float(1)));
-						if (ringIndex == selectedRing) {
-							if (currentChainRelative == selectedChain1Relative) {
-								chain1 = c;
-							}
-							if (currentChainRelative == selectedChain2Relative) {
-								chain2 = c;
-							}
-							++currentChainRelative;
-						}
-					}
-					assert(chain1 != -1);
-					assert(chain2 != -1);
+					const uint32_t chain1 = occupancy.member(selectedRing, selectedChain1Relative);
+					const uint32_t chain2 = occupancy.member(selectedRing, selectedChain2Relative);
 					assert(chain1 != chain2);
 					++chains[chain1].swapAttempts;
 					++chains[chain2].swapAttempts;
-					if (swapRatio(chain1, chain2) > random()) {
+					TFloat log1_t2, log2_t1;
+					if (swapRatio(chain1, chain2, log1_t2, log2_t1) > random()) {
 						++chains[chain1].swaps;
 						++chains[chain2].swaps;
-						auto temp = chains[chain1].mutator->getState();
-						chains[chain1].mutator->setState(chains[chain2].mutator->getState());
-						chains[chain2].mutator->setState(temp);
+						swapStates(chain1, chain2, log1_t2, log2_t1);
 					}
 				}
 			}
@@ -217,51 +232,95 @@ public:
 
 	virtual void printStats() const override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
-			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << Float(100) * chains[i].mutator->acceptanceRate()
-				<< " % Swap rate: " << Float(100) * (chains[i].swaps / Float(chains[i].swapAttempts)) << " %" <<  std::endl;
+			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << TFloat(100) * chains[i].mutator->acceptanceRate()
+				<< " % Swap rate: " << TFloat(100) * (chains[i].swaps / TFloat(chains[i].swapAttempts)) << " %" <<  std::endl;
+		}
+		std::cout << "Moves rate " << TFloat(100) * (movesPossible / TFloat(movesAttempts)) << " %" << std::endl;
+	}
+
+	virtual void seed(const Pcg& stream) override {
+		Algorithm<TDimension, TFloat>::seed(stream);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			const Pcg chain = this->chainStream(stream, i);
+			chains[i].random = chain.stream(0, PCG_GENERATOR_STREAM);
+			chains[i].randomLanes.reset(chain, 1, PCG_GENERATOR_STREAM);
+		}
+		random = stream.stream(this->FIRST_FREE_GENERATOR, PCG_GENERATOR_STREAM);
+	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		const EquiEnergyMovesAlgorithm& algorithm = static_cast<const EquiEnergyMovesAlgorithm&>(other);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			chains[i].mutator->mergeStats(*algorithm.chains[i].mutator);
+			chains[i].swapAttempts += algorithm.chains[i].swapAttempts;
+			chains[i].swaps += algorithm.chains[i].swaps;
 		}
-		std::cout << "Moves rate " << Float(100) * (movesPossible / Float(movesAttempts)) << " %" << std::endl;
+		movesPossible += algorithm.movesPossible;
+		movesAttempts += algorithm.movesAttempts;
 	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed, const uint32_t chainNo) const {
-		const Float valCurr = this->mIntegrand.value(current, chains[chainNo].invTemperature);
-		const Float valProp = this->mIntegrand.value(proposed, chains[chainNo].invTemperature);
-		return valCurr > Float(0) ? std::min(Float(1), valProp / valCurr) : Float(1);
+	INLINE TFloat acceptRatio(const uint32_t chainNo, const TFloat logProposed) const {
+		const TFloat logCurr = chains[chainNo].mutator->getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
+	}
+
+	// Only the exchanged values are evaluated, they are returned for swapStates
+	INLINE TFloat swapRatio(const uint32_t chain1, const uint32_t chain2, TFloat& log1_t2, TFloat& log2_t1) const {
+		log1_t2 = logValue(chains[chain1].signature, chain2);
+		log2_t1 = logValue(chains[chain2].signature, chain1);
+		return ratioFromLog((log1_t2 - chains[chain1].mutator->getLogValue()) + (log2_t1 - chains[chain2].mutator->getLogValue()));
 	}
 
-	INLINE Float swapRatio(const uint32_t chain1, const uint32_t chain2) const {
-		const auto state1 = chains[chain1].mutator->getState();
-		const auto state2 = chains[chain2].mutator->getState();
-		const Float val1_t1 = this->mIntegrand.value(state1, chains[chain1].invTemperature);
-		const Float val1_t2 = this->mIntegrand.value(state1, chains[chain2].invTemperature);
-		const Float val2_t1 = this->mIntegrand.value(state2, chains[chain1].invTemperature);
-		const Float val2_t2 = this->mIntegrand.value(state2, chains[chain2].invTemperature);
-		const Float factor1 = val1_t2 / val1_t1;
-		const Float factor2 = val2_t1 / val2_t2;
-		return std::min(Float(1), factor1 * factor2);
+	INLINE void swapStates(const uint32_t chain1, const uint32_t chain2, const TFloat log1_t2, const TFloat log2_t1) {
+		const Vector<TDimension, TFloat> temp = chains[chain1].mutator->getState();
+		chains[chain1].mutator->setState(chains[chain2].mutator->getState(), log2_t1);
+		chains[chain2].mutator->setState(temp, log1_t2);
+		std::swap(chains[chain1].signature, chains[chain2].signature);
+		std::swap(chains[chain1].values, chains[chain2].values);
+		for (RingOccupancy& occupancy : mOccupancy) {
+			occupancy.swap(chain1, chain2);
+		}
 	}
 
-	INLINE Float value(const Vector<TDimension>& state, const uint32_t chainNo) const {
-		return this->mIntegrand.value(state, chains[chainNo].invTemperature);
+	// After the values of the state of the chain changed
+	INLINE void updateRings(const uint32_t chain) {
+		for (uint32_t t = 0; t < uint32_t(mOccupancy.size()); ++t) {
+			mOccupancy[t].move(chain, ringNumber(chains[t], chains[chain].values[t]));
+		}
 	}
 
-	INLINE void computeLevels(std::vector<Float>& levels, const Float maxValue) {
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& state, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(state, chains[chainNo].invTemperature);
+	}
+
+	INLINE TFloat logValue(const Signature& signature, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(signature, chains[chainNo].invTemperature);
+	}
+
+	INLINE void computeLevels(std::vector<TFloat>& levels, TFloat& spacing, const TFloat maxValue) {
 		levels.resize(mRingCount - 1);
-		const Float dist = pow(maxValue, 1 / Float(mRingCount));
-		Float it(0);
-		for (Float & l : levels) {
+		const TFloat dist = pow(maxValue, 1 / TFloat(mRingCount));
+		TFloat it(0);
+		for (TFloat & l : levels) {
 			it += dist;
 			l = it;
 		}
+		spacing = dist;
 	}
 
-	INLINE uint32_t ringNumber(const std::vector<Float>& levels, Float value) {
-		for (uint32_t i = 0; i < uint32_t(levels.size()); ++i) {
-			if (levels[i] > value) {
-				return i;
-			}
+	// Index of the first level above the value, at the levels of the chain. The levels are multiples of the spacing, so the
+	// division is exact up to the rounding of the summed levels, which the comparisons fix
+	INLINE uint32_t ringNumber(const Chain& chain, const TFloat value) const {
+		const uint32_t levelCount = uint32_t(chain.levels.size());
+		const TFloat guess = value / chain.levelSpacing;
+		uint32_t ring = guess < TFloat(levelCount) ? uint32_t(std::max(guess, TFloat(0))) : levelCount;
+		while (ring > 0 && chain.levels[ring - 1] > value) {
+			--ring;
+		}
+		while (ring < levelCount && chain.levels[ring] <= value) {
+			++ring;
 		}
-		return uint32_t(levels.size());
+		return ring;
 	}
 	
 };
@@ -0,0 +1,176 @@
+#pragma once
+#include "Config.h"
+#include <stdint.h>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+// In place radix-2 transform, the size must be a power of two. The inverse is not divided by the size
+inline void fft(std::vector<std::complex<double>>& data, const bool inverse) {
+	const size_t n = data.size();
+	for (size_t i = 1, j = 0; i < n; ++i) {
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j) {
+			std::swap(data[i], data[j]);
+		}
+	}
+	// Every twiddle from its own angle, repeated multiplication would lose precision on long series
+	std::vector<std::complex<double>> twiddles(n / 2);
+	for (size_t k = 0; k < n / 2; ++k) {
+		twiddles[k] = std::polar(1.0, (inverse ? 2.0 : -2.0) * M_PI * double(k) / double(n));
+	}
+	for (size_t length = 2; length <= n; length <<= 1) {
+		const size_t half = length / 2, stride = n / length;
+		for (size_t i = 0; i < n; i += length) {
+			for (size_t k = 0; k < half; ++k) {
+				const std::complex<double> even = data[i + k], odd = data[i + k + half] * twiddles[k * stride];
+				data[i + k] = even + odd;
+				data[i + k + half] = even - odd;
+			}
+		}
+	}
+}
+
+// Streaming effective sample size of the mean of one scalar series. The values are summed into batches of a power of two
+// size, when the capacity fills the neighbouring batches merge and the size doubles, so the memory stays bounded however
+// long the series is (and short series are kept whole). The integrated autocorrelation time comes either from the
+// autocorrelation of the batch means, by FFT and truncated by Geyer's initial positive sequence, or from the variance of
+// about sqrt(n) long batches. The variance of the series itself is accumulated over every value
+class EffectiveSampleSize {
+	std::vector<double> mBatches; // Sums of the complete batches
+	std::vector<std::complex<double>> mTransform; // Scratch of the autocorrelation
+	size_t mCapacity;
+	uint64_t mBatchSize, mPartialCount, mCount;
+	double mPartial, mMean, mSquares;
+public:
+	// The capacity in batches, even
+	EffectiveSampleSize(const size_t capacity = size_t(1) << 16) : mCapacity(std::max(capacity & ~size_t(1), size_t(4))) {
+		clear();
+	}
+
+	INLINE uint64_t count() const {
+		return mCount;
+	}
+
+	void clear() {
+		mBatches.clear();
+		mBatchSize = 1;
+		mPartialCount = 0;
+		mCount = 0;
+		mPartial = 0;
+		mMean = 0;
+		mSquares = 0;
+	}
+
+	INLINE void add(const double value) {
+		++mCount;
+		const double delta = value - mMean;
+		mMean += delta / double(mCount);
+		mSquares += delta * (value - mMean);
+		mPartial += value;
+		if (++mPartialCount == mBatchSize) {
+			mBatches.push_back(mPartial);
+			mPartial = 0;
+			mPartialCount = 0;
+			if (mBatches.size() == mCapacity) {
+				mergeBatches();
+			}
+		}
+	}
+
+	// The values of an incomplete last batch are left out, too short a series counts as independent
+	double autocorrelation() {
+		const size_t m = mBatches.size();
+		if (m < 4) {
+			return double(mCount);
+		}
+		const double batchSize = double(mBatchSize);
+		double mean = 0;
+		for (const double sum : mBatches) {
+			mean += sum;
+		}
+		mean /= double(m) * batchSize;
+		// Zero padded to twice the length, so the circular correlation does not wrap around
+		size_t size = 2;
+		while (size < 2 * m) {
+			size <<= 1;
+		}
+		mTransform.assign(size, std::complex<double>(0));
+		for (size_t j = 0; j < m; ++j) {
+			mTransform[j] = mBatches[j] / batchSize - mean;
+		}
+		fft(mTransform, false);
+		for (std::complex<double>& c : mTransform) {
+			c = std::norm(c);
+		}
+		fft(mTransform, true);
+		// mTransform[t] is size * m times the autocovariance at lag t
+		const double lagZero = mTransform[0].real();
+		if (lagZero <= 0) {
+			return fromAsymptoticVariance(0, m * mBatchSize);
+		}
+		// 1 + 2 sum of the autocorrelations, summed in pairs of lags while the pairs are positive
+		double time = -1;
+		for (size_t t = 0; t + 1 < m; t += 2) {
+			const double pair = (mTransform[t].real() + mTransform[t + 1].real()) / lagZero;
+			if (pair <= 0) {
+				break;
+			}
+			time += 2 * pair;
+		}
+		return fromAsymptoticVariance(batchSize * lagZero / (double(size) * double(m)) * time, m * mBatchSize);
+	}
+
+	// The batches are grouped to about sqrt(n) values each, too short a series counts as independent
+	double batchMeans() const {
+		const size_t m = mBatches.size();
+		const uint64_t n = m * mBatchSize;
+		const size_t group = std::max(size_t(1), size_t(std::sqrt(double(n)) / double(mBatchSize)));
+		const size_t groups = m / group;
+		if (groups < 2) {
+			return double(mCount);
+		}
+		const double length = double(group * mBatchSize);
+		std::vector<double> means(groups, 0.0);
+		double mean = 0;
+		for (size_t g = 0; g < groups; ++g) {
+			for (size_t j = g * group; j < (g + 1) * group; ++j) {
+				means[g] += mBatches[j];
+			}
+			means[g] /= length;
+			mean += means[g];
+		}
+		mean /= double(groups);
+		double squares = 0;
+		for (const double groupMean : means) {
+			squares += (groupMean - mean) * (groupMean - mean);
+		}
+		return fromAsymptoticVariance(length * squares / double(groups - 1), groups * group * mBatchSize);
+	}
+
+private:
+	// Neighbouring batches are added, the capacity is even
+	void mergeBatches() {
+		for (size_t j = 0; j < mBatches.size() / 2; ++j) {
+			mBatches[j] = mBatches[2 * j] + mBatches[2 * j + 1];
+		}
+		mBatches.resize(mBatches.size() / 2);
+		mBatchSize *= 2;
+	}
+
+	// n times the variance over the variance of the mean times n. A constant series is worth one sample, and the size is
+	// capped at n log10 n as antithetic series would go up without bound
+	double fromAsymptoticVariance(const double asymptoticVariance, const uint64_t n) const {
+		const double variance = mCount > 1 ? mSquares / double(mCount - 1) : 0.0;
+		if (variance <= 0) {
+			return 1;
+		}
+		const double limit = double(n) * std::max(1.0, std::log10(double(n)));
+		return asymptoticVariance > 0 ? std::min(double(n) * variance / asymptoticVariance, limit) : limit;
+	}
+};
\ No newline at end of file
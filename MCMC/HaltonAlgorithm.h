@@ -1,15 +1,15 @@
 #pragma once
 #include "Algorithm.h"
 
-template<uint32_t TDimension>
-class HaltonAlgorithm : public Algorithm<TDimension> {
+template<uint32_t TDimension, typename TFloat = Float>
+class HaltonAlgorithm : public Algorithm<TDimension, TFloat> {
 public:
-	INLINE HaltonAlgorithm(const Integrand<TDimension>& integrand) : Algorithm<TDimension>(integrand) {}
+	INLINE HaltonAlgorithm(const Integrand<TDimension, TFloat>& integrand) : Algorithm<TDimension, TFloat>(integrand) {}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < uint32_t(samples.size()); ++i) {
-			samples[i].sample = haltonVector<TDimension>(i);
-			samples[i].pdf = Float(1);
+			samples[i].sample = haltonVector<TDimension, TFloat>(i);
+			samples[i].pdf = TFloat(1);
 		}
 	}
 
@@ -1,15 +1,24 @@
 #pragma once
 #include "MixtureDistribution.h"
-template<uint32_t TDimension>
+#include "Parallel.h"
+template<uint32_t TDimension, typename TFloat = Float>
 class Integrand {
 public:
-	using TDist = MixtureDistribution<NormalDistribution<TDimension>>;
+	using TDist = MixtureDistribution<NormalDistribution<TDimension, TFloat>>;
 private:
 	 TDist mDist;
+	mutable ShardedCounter mEvaluations; // States evaluated from their vectors, the costly part
 public:
+	// Cached per state, so the state can be evaluated at any temperature for K exps and no matrix products
+	struct StateSignature {
+		std::vector<TFloat> quadraticForms;
+		bool inside;
+	};
+
 	INLINE Integrand(const TDist &dist) : mDist(dist) {}
 
-	INLINE Float value(const Vector<TDimension>& v, const Float invTemperature) const {
+	INLINE TFloat value(const Vector<TDimension, TFloat>& v, const TFloat invTemperature) const {
+		mEvaluations.add(1);
 		if (inside(v)) {
 			return mDist.pdfTempered(v, invTemperature);
 		} else {
@@ -17,19 +26,81 @@ public:
 		}
 	}
 
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& v, const TFloat invTemperature) const {
+		mEvaluations.add(1);
+		if (inside(v)) {
+			return mDist.logPdfTempered(v, invTemperature);
+		} else {
+			return LOG_ZERO;
+		}
+	}
+
+	INLINE void signature(const Vector<TDimension, TFloat>& v, StateSignature& out) const {
+		mEvaluations.add(1);
+		out.inside = inside(v);
+		if (out.inside) {
+			mDist.quadraticForms(v, out.quadraticForms);
+		}
+	}
+
+	INLINE TFloat logValue(const StateSignature& s, const TFloat invTemperature) const {
+		return s.inside ? mDist.logPdfTemperedFromForms(s.quadraticForms, invTemperature) : LOG_ZERO;
+	}
+
+	INLINE TFloat value(const StateSignature& s, const TFloat invTemperature) const {
+		return s.inside ? exp(logValue(s, invTemperature)) : TFloat(0);
+	}
+
+	// Evaluates one state at every temperature, the quadratic forms are computed only once
+	INLINE void logValueAllTemperatures(const StateSignature& s, const std::vector<TFloat>& invTemperatures, std::vector<TFloat>& out) const {
+		if (s.inside) {
+			mDist.logPdfTemperedFromForms(s.quadraticForms, invTemperatures, out);
+		} else {
+			out.assign(invTemperatures.size(), LOG_ZERO);
+		}
+	}
+
+	INLINE void valueAllTemperatures(const StateSignature& s, const std::vector<TFloat>& invTemperatures, std::vector<TFloat>& out) const {
+		logValueAllTemperatures(s, invTemperatures, out);
+		for (TFloat& v : out) {
+			v = exp(v);
+		}
+	}
+
+	INLINE void valueAllTemperatures(const Vector<TDimension, TFloat>& v, const std::vector<TFloat>& invTemperatures, std::vector<TFloat>& out) const {
+		StateSignature s;
+		signature(v, s);
+		valueAllTemperatures(s, invTemperatures, out);
+	}
+
+	// Calls of value, logValue and signature on a vector by all threads so far (valueAndMode is not counted, a copy starts
+	// from zero)
+	INLINE uint64_t evaluations() const {
+		return mEvaluations.value();
+	}
+
 	INLINE uint32_t modeCount() const {
 		return mDist.modeCount();
 	}
 
-	INLINE uint32_t mode(const Vector<TDimension>& v) const {
+	INLINE uint32_t mode(const Vector<TDimension, TFloat>& v) const {
 		return mDist.mode(v);
 	}
 
+	// value(v, 1) and, where it is not zero, mode(v) for the price of one of them
+	INLINE TFloat valueAndMode(const Vector<TDimension, TFloat>& v, uint32_t& mode) const {
+		if (inside(v)) {
+			return mDist.pdfAndMode(v, mode);
+		}
+		mode = modeCount();
+		return TFloat(0);
+	}
+
 	INLINE const TDist& getDistribution() const {
 		return mDist;
 	}
 
-	INLINE bool inside(const Vector<TDimension>& v) const {
+	INLINE bool inside(const Vector<TDimension, TFloat>& v) const {
 		bool result = true;
 		for (int i = 0; i < TDimension; ++i) {
 			result &= v[i] >= 0.f && v[i] <= 1.f;
@@ -37,7 +108,7 @@ public:
 		return result;
 	}
 
-	INLINE Float maxValue(const Float invTemperature) const {
+	INLINE TFloat maxValue(const TFloat invTemperature) const {
 		return mDist.highestPdf(invTemperature);
 	}
 };
\ No newline at end of file
@@ -1,15 +1,16 @@
 #pragma once
 #include "Utils.h"
 
-template<uint32_t TDimension>
+template<uint32_t TDimension, typename TFloat = Float>
 class LocalMutation {
 	Pcg& mRandom;
 	bool mAdaptive;
-	Float mGoalAcceptance;
+	TFloat mGoalAcceptance;
 	uint32_t mAcceptedAll, mRejectedAll, mAcceptedLocal, mRejectedLocal, mUpdates;
-	Float mS1,mS2, mLogRatio;
-	Float mLocalMutationSize;
-	Vector<TDimension> mState;
+	TFloat mS1,mS2, mLogRatio;
+	TFloat mLocalMutationSize;
+	Vector<TDimension, TFloat> mState;
+	TFloat mLogValue; // Log of the integrand at the state, at the temperature of the owner
 public:
 	INLINE LocalMutation(Pcg& random) :mRandom(random), mAdaptive(false) {
 		mS1 = 1.0f / 1024.0f;
@@ -19,23 +20,28 @@ public:
 		mRejectedAll = 0;
 	}
 
-	INLINE Vector<TDimension> mutateState() {
-		Vector<TDimension> temp;
+	INLINE Vector<TDimension, TFloat> mutateState() {
+		Vector<TDimension, TFloat> temp;
 		for (uint32_t d = 0; d < TDimension; ++d) {
 			temp[d] = mutate1D(mState[d]);
 		}
 		return temp;
 	}
 
-	INLINE const Vector<TDimension>& getState() const {
+	INLINE const Vector<TDimension, TFloat>& getState() const {
 		return mState;
 	}
 
-	INLINE void setState(const Vector<TDimension>& state) {
+	INLINE TFloat getLogValue() const {
+		return mLogValue;
+	}
+
+	INLINE void setState(const Vector<TDimension, TFloat>& state, const TFloat logValue) {
 		mState = state;
+		mLogValue = logValue;
 	}
 
-	INLINE void startAdaptation(const Float goalAcceptance) {
+	INLINE void startAdaptation(const TFloat goalAcceptance) {
 		mGoalAcceptance = goalAcceptance;
 		mAdaptive = true;
 		mAcceptedLocal = 0;
@@ -44,8 +50,9 @@ public:
 		mLocalMutationSize = mS2;
 	}
 
-	INLINE void mutationWasAccepted(const Vector<TDimension>& proposed, const bool localMutation) {
+	INLINE void mutationWasAccepted(const Vector<TDimension, TFloat>& proposed, const TFloat logValue, const bool localMutation) {
 		mState = proposed;
+		mLogValue = logValue;
 		++mAcceptedAll;
 		++mAcceptedLocal;
 		if (!mAdaptive || !localMutation) {
@@ -63,12 +70,17 @@ public:
 		adaptMutation();
 	}
 
-	INLINE Float acceptanceRate() const {
-		return mAcceptedAll / Float(mAcceptedAll + mRejectedAll);
+	INLINE void mergeStats(const LocalMutation<TDimension, TFloat>& other) {
+		mAcceptedAll += other.mAcceptedAll;
+		mRejectedAll += other.mRejectedAll;
+	}
+
+	INLINE TFloat acceptanceRate() const {
+		return mAcceptedAll / TFloat(mAcceptedAll + mRejectedAll);
 	}
 private:
-	INLINE Float mutate1D(Float value) {
-		Float sample = mRandom();
+	INLINE TFloat mutate1D(TFloat value) {
+		TFloat sample = mRandom.uniform<TFloat>();
 		bool add;
 
 		if (sample < 0.5f) {
@@ -79,7 +91,7 @@ private:
 			add = false;
 			sample = 2.0f * (sample - 0.5f);
 		}
-		const Float dv = mAdaptive ? pow(sample, (1 / mLocalMutationSize) + Float(1)) :
+		const TFloat dv = mAdaptive ? pow(sample, (1 / mLocalMutationSize) + TFloat(1)) :
 			mS2 * exp(sample * mLogRatio);
 		if (add) {
 			value += dv;
@@ -97,8 +109,8 @@ private:
 	INLINE void adaptMutation() {
 		const uint32_t count = mAcceptedLocal + mRejectedLocal;
 		assert(count > 0);
-		const Float ratio = mAcceptedLocal / Float(count);
-		const Float newSize = mLocalMutationSize + (ratio - mGoalAcceptance) / (mUpdates + 1);
+		const TFloat ratio = mAcceptedLocal / TFloat(count);
+		const TFloat newSize = mLocalMutationSize + (ratio - mGoalAcceptance) / (mUpdates + 1);
 		if (newSize > 0 && newSize < 1) {
 			++mUpdates;
 			mLocalMutationSize = newSize;
@@ -1,18 +1,18 @@
 #pragma once
 #include "Config.h"
 
-template<uint32_t TRows, uint32_t TColumns>
+template<uint32_t TRows, uint32_t TColumns, typename TFloat = Float>
 class Matrix {
 	static_assert(TRows >= 1, "Rows must be positive.");
 	static_assert(TColumns >= 1, "Colums must be positive.");
-	Vector<TColumns> mData[TRows];
+	Vector<TColumns, TFloat> mData[TRows];
 public:
 
 	INLINE Matrix() = default;
 
-	INLINE Matrix(const Float x) {
+	INLINE Matrix(const TFloat x) {
 		for (int i = 0; i < TRows; ++i) {
-			mData[i] = Vector<TColumns>(x);
+			mData[i] = Vector<TColumns, TFloat>(x);
 		}
 	}
 	INLINE Matrix operator+(const Matrix& v) const {
@@ -32,11 +32,11 @@ public:
 	}
 
 	template<uint32_t TColumns2>
-	INLINE Matrix<TRows, TColumns2> operator*(const Matrix<TColumns, TColumns2>& v) const {
+	INLINE Matrix<TRows, TColumns2, TFloat> operator*(const Matrix<TColumns, TColumns2, TFloat>& v) const {
 		Matrix temp;
 		for (int r = 0; r < TRows; ++r) {
 			for (int c = 0; c < TColumns2; ++c) {
-				temp[r][c] = Float(0);
+				temp[r][c] = TFloat(0);
 				for (int i = 0; i < TColumns; ++i) {
 					temp[r][c] += mData[r][i] * v.mData[i][c];
 				}
@@ -68,20 +68,20 @@ public:
 		return temp;
 	}
 
-	INLINE Vector<TColumns> operator[](const uint32_t index) const {
+	INLINE Vector<TColumns, TFloat> operator[](const uint32_t index) const {
 		assert(index >= 0 && index < TRows);
 		return mData[index];
 	}
 
-	INLINE Vector<TColumns>& operator[](const uint32_t index) {
+	INLINE Vector<TColumns, TFloat>& operator[](const uint32_t index) {
 		assert(index >= 0 && index < TRows);
 		return mData[index];
 	}
 
-	INLINE Vector<TRows> operator*(const Vector<TColumns>& v) const {
-		Vector<TRows> temp;
+	INLINE Vector<TRows, TFloat> operator*(const Vector<TColumns, TFloat>& v) const {
+		Vector<TRows, TFloat> temp;
 		for (int r = 0; r < TRows; ++r) {
-			temp[r] = Float(0);
+			temp[r] = TFloat(0);
 			for (int i = 0; i < TColumns; ++i) {
 				temp[r] += mData[r][i] * v[i];
 			}
@@ -89,21 +89,21 @@ public:
 		return temp;
 	}
 
-	INLINE Matrix operator*=(const Float f) {
+	INLINE Matrix operator*=(const TFloat f) {
 		for (int i = 0; i < TRows; ++i) {
 			mData[i] *= f;
 		}
 		return *this;
 	}
 
-	INLINE Matrix operator/=(const Float f) {
+	INLINE Matrix operator/=(const TFloat f) {
 		for (int i = 0; i < TRows; ++i) {
 			mData[i] /= f;
 		}
 		return *this;
 	}
 
-	INLINE Matrix operator*(const Float f) const {
+	INLINE Matrix operator*(const TFloat f) const {
 		Matrix temp;
 		for (int i = 0; i < TRows; ++i) {
 			temp[i] = mData[i] * f;
@@ -111,7 +111,7 @@ public:
 		return temp;
 	}
 
-	INLINE Matrix operator/(const Float f) const {
+	INLINE Matrix operator/(const TFloat f) const {
 		Matrix temp;
 		for (int i = 0; i < TRows; ++i) {
 			temp[i] = mData[i] / f;
@@ -122,22 +122,25 @@ public:
 
 using Matrix2x2 = Matrix<2, 2>;
 
-INLINE Float determinant(const Matrix2x2 &m) {
+template<typename TFloat>
+INLINE TFloat determinant(const Matrix<2, 2, TFloat> &m) {
 	return m[0][0] * m[1][1] - m[0][1] * m[1][0];
 }
 
-INLINE Matrix2x2 invert(const Matrix2x2 &m) {
-	const Float det = determinant(m);
-	assert(det != Float(0));
-	Matrix2x2 temp = m;
+template<typename TFloat>
+INLINE Matrix<2, 2, TFloat> invert(const Matrix<2, 2, TFloat> &m) {
+	const TFloat det = determinant(m);
+	assert(det != TFloat(0));
+	Matrix<2, 2, TFloat> temp = m;
 	std::swap(temp[0][0], temp[1][1]);
 	temp[1][0] = -temp[1][0];
 	temp[0][1] = -temp[0][1];
 	return temp / det;
 }
 
-INLINE Matrix2x2 makeMatrix2x2(const Float m00, const Float m01, const Float m10, const Float m11) {
-	Matrix2x2 temp;
+template<typename TFloat>
+INLINE Matrix<2, 2, TFloat> makeMatrix2x2(const TFloat m00, const TFloat m01, const TFloat m10, const TFloat m11) {
+	Matrix<2, 2, TFloat> temp;
 	temp[0][0] = m00;
 	temp[0][1] = m01;
 	temp[1][0] = m10;
@@ -145,9 +148,10 @@ INLINE Matrix2x2 makeMatrix2x2(const Float m00, const Float m01, const Float m10
 	return temp;
 }
 
-INLINE Matrix2x2 cholesky(const Matrix2x2 &m) {
-	const Float a = sqrt(m[0][0]);
-	const Float b = m[0][1] / a;
-	const Float c = sqrt(m[1][1] - b * b);
-	return makeMatrix2x2(a, 0, b, c);
+template<typename TFloat>
+INLINE Matrix<2, 2, TFloat> cholesky(const Matrix<2, 2, TFloat> &m) {
+	const TFloat a = sqrt(m[0][0]);
+	const TFloat b = m[0][1] / a;
+	const TFloat c = sqrt(m[1][1] - b * b);
+	return makeMatrix2x2(a, TFloat(0), b, c);
 }
\ No newline at end of file
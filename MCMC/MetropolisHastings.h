@@ -2,31 +2,33 @@
 #include "Algorithm.h"
 #include "LocalMutation.h"
 
-template<uint32_t TDimension>
-class MetropolisHastingsAlgorithm : public Algorithm<TDimension> {
-	LocalMutation<TDimension> mMutator;
-	Float mLargeStepProb;
+template<uint32_t TDimension, typename TFloat = Float>
+class MetropolisHastingsAlgorithm : public Algorithm<TDimension, TFloat> {
+	LocalMutation<TDimension, TFloat> mMutator;
+	TFloat mLargeStepProb;
 public:
-	INLINE MetropolisHastingsAlgorithm(const Integrand<TDimension>& integrand) : Algorithm<TDimension>(integrand), mMutator(this->mRandom) {
+	INLINE MetropolisHastingsAlgorithm(const Integrand<TDimension, TFloat>& integrand) : Algorithm<TDimension, TFloat>(integrand), mMutator(this->mRandom) {
 		mLargeStepProb = 0.3f;
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		do {
-			mMutator.setState(randomVector<TDimension>(this->mRandom));
-		} while ((this->mIntegrand.value(mMutator.getState(), Float(1))) == Float(0));
+			const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(this->mRandom);
+			mMutator.setState(state, this->mIntegrand.logValue(state, TFloat(1)));
+		} while (exp(mMutator.getLogValue()) == TFloat(0)); // Start where the value does not underflow
 		mMutator.startAdaptation(0.3f);
 		for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
 			const bool localStep = i % 3 != 0;
-			Vector<TDimension> proposed;
+			Vector<TDimension, TFloat> proposed;
 			if (localStep) {
 				proposed = mMutator.mutateState();
 			}
 			else {
-				proposed = randomVector<TDimension>(this->mRandom);
+				proposed = randomVector<TDimension, TFloat>(this->mRandomLanes);
 			}
-			if (acceptRatio(mMutator.getState(), proposed) > this->mRandom()) {
-				mMutator.mutationWasAccepted(proposed, localStep);
+			const TFloat logProposed = this->mIntegrand.logValue(proposed, TFloat(1));
+			if (acceptRatio(logProposed) > this->mRandom()) {
+				mMutator.mutationWasAccepted(proposed, logProposed, localStep);
 			}
 			else {
 				mMutator.mutationWasRejected(localStep);
@@ -34,7 +36,7 @@ public:
 			if (i >= MCMC_BURN_PERIOD) {
 				const uint32_t index = i - MCMC_BURN_PERIOD;
 				samples[index].sample = mMutator.getState();
-				samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
+				samples[index].pdf = exp(mMutator.getLogValue());
 			}
 		}
 	}
@@ -50,12 +52,15 @@ public:
 	virtual bool hasNormalizedPdf() const override { return false; }
 
 	virtual void printStats() const override {
-		std::cout << "Acceptance rate: " << Float(100) * mMutator.acceptanceRate() << " %" << std::endl;
+		std::cout << "Acceptance rate: " << TFloat(100) * mMutator.acceptanceRate() << " %" << std::endl;
+	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		mMutator.mergeStats(static_cast<const MetropolisHastingsAlgorithm&>(other).mMutator);
 	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed) const {
-		const Float valCurr = this->mIntegrand.value(current, Float(1));
-		const Float valProp = this->mIntegrand.value(proposed, Float(1));
-		return valCurr > Float(0) ? std::min(Float(1),valProp / valCurr) : Float(1);
+	INLINE TFloat acceptRatio(const TFloat logProposed) const {
+		const TFloat logCurr = mMutator.getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
 	}
 };
\ No newline at end of file
@@ -1,47 +1,169 @@
 #pragma once
 #include "Utils.h"
 #include "NormalDistribution.h"
+#include "Simd.h"
 #include <vector>
 
 template<typename TDistribution>
 class MixtureDistribution {
+	using TFloat = typename TDistribution::FloatType;
+	using SimdType = Simd<TFloat>;
+	static constexpr uint32_t BLOCKS = TDistribution::DIMENSION / 2;
 	std::vector<TDistribution> mDistributions;
-	std::vector<Float> mCdf;
+	std::vector<TFloat> mCdf;
+	// Structure of arrays copy of the components for the SIMD kernels, padded to a multiple of SimdType::WIDTH
+	uint32_t mPaddedCount;
+	AlignedVector<TFloat> mPackedLogBase; // Log of the normalized weight divided by the component normalization, padding has zero weight
+	AlignedVector<TFloat> mPackedLogModeWeight; // Log of the weight mode() gives the component divided by its normalization
+	AlignedVector<TFloat> mPackedMean; // [dimension * mPaddedCount + component]
+	AlignedVector<TFloat> mPackedInvSigma; // [(3 * block + entry) * mPaddedCount + component], entries are s00, s01 + s10 and s11
 public:
-	INLINE MixtureDistribution() = default;
+	INLINE MixtureDistribution() : mPaddedCount(0) {}
 
-	INLINE MixtureDistribution(const std::vector<TDistribution>& distributions, const std::vector<Float>& weights): mDistributions(distributions) {
+	INLINE MixtureDistribution(const std::vector<TDistribution>& distributions, const std::vector<TFloat>& weights): mDistributions(distributions) {
 		assert(weights.size() == distributions.size());
 		mCdf.resize(weights.size());
-		Float accum(0);
+		TFloat accum(0);
 		for (int i = 0; i < weights.size(); ++i) {
 			accum += weights[i];
 			mCdf[i] = accum;
 		}
+		mPaddedCount = (uint32_t(weights.size()) + SimdType::WIDTH - 1) / SimdType::WIDTH * SimdType::WIDTH;
+		mPackedLogBase.assign(mPaddedCount, LOG_ZERO);
+		mPackedLogModeWeight.assign(mPaddedCount, LOG_ZERO);
+		mPackedMean.assign(2 * BLOCKS * mPaddedCount, TFloat(0));
+		mPackedInvSigma.assign(3 * BLOCKS * mPaddedCount, TFloat(0));
+		for (uint32_t i = 0; i < uint32_t(weights.size()); ++i) {
+			mPackedLogBase[i] = log(weights[i] / accum) - mDistributions[i].logNormalization();
+			mPackedLogModeWeight[i] = log(mCdf[i]) - mDistributions[i].logNormalization();
+			for (uint32_t b = 0; b < BLOCKS; ++b) {
+				const Vector<2, TFloat> mean = mDistributions[i].block(b).mean();
+				const Matrix<2, 2, TFloat> invSigma = mDistributions[i].block(b).invertedSigma();
+				mPackedMean[(2 * b) * mPaddedCount + i] = mean[0];
+				mPackedMean[(2 * b + 1) * mPaddedCount + i] = mean[1];
+				mPackedInvSigma[(3 * b) * mPaddedCount + i] = invSigma[0][0];
+				mPackedInvSigma[(3 * b + 1) * mPaddedCount + i] = invSigma[0][1] + invSigma[1][0];
+				mPackedInvSigma[(3 * b + 2) * mPaddedCount + i] = invSigma[1][1];
+			}
+		}
 	}
 
 	template<typename TVector>
-	INLINE Float pdf(const TVector& x) const {
-		Float total(0), prevCdf(0);
-		for (int i = 0; i < mDistributions.size(); ++i) {
-			total += mDistributions[i].pdf(x) * (mCdf[i] - prevCdf);
-			prevCdf = mCdf[i];
+	INLINE TFloat pdf(const TVector& x) const {
+		return pdfTempered(x, TFloat(1));
+	}
+
+	template<typename TVector>
+	INLINE TFloat pdfTempered(const TVector& x, const TFloat invTemperature) const {
+		const SimdType scale(TFloat(-0.5) * invTemperature);
+		SimdType sum(TFloat(0));
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			sum = sum + exp(fma(scale, packedQuadraticForm(x, j), SimdType::load(&mPackedLogBase[j])));
 		}
-		return total / prevCdf;
+		return sum.horizontalSum() * pow(invTemperature, TFloat(BLOCKS));
 	}
 
+	// pdf(x) and mode(x) from one evaluation of the quadratic forms, the mode compares the components in log space
 	template<typename TVector>
-	INLINE Float pdfTempered(const TVector& x, const Float invTemperature) const {
-		Float total(0), prevCdf(0);
-		for (int i = 0; i < mDistributions.size(); ++i) {
-			total += mDistributions[i].pdfTempered(x, invTemperature) * (mCdf[i] - prevCdf);
-			prevCdf = mCdf[i];
+	INLINE TFloat pdfAndMode(const TVector& x, uint32_t& mode) const {
+		const SimdType scale(TFloat(-0.5));
+		SimdType sum(TFloat(0));
+		alignas(64) TFloat modeLogs[SimdType::WIDTH];
+		TFloat maxLog(LOG_ZERO);
+		mode = modeCount();
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			const SimdType form = packedQuadraticForm(x, j);
+			sum = sum + exp(fma(scale, form, SimdType::load(&mPackedLogBase[j])));
+			fma(scale, form, SimdType::load(&mPackedLogModeWeight[j])).storeUnaligned(modeLogs);
+			for (uint32_t k = 0; k < SimdType::WIDTH && j + k < uint32_t(mDistributions.size()); ++k) {
+				if (modeLogs[k] > maxLog) {
+					maxLog = modeLogs[k];
+					mode = j + k;
+				}
+			}
 		}
-		return total / prevCdf;
+		return sum.horizontalSum();
 	}
 
-	INLINE Float highestPdf(const Float invTemperature) const {
-		Float highest(0), prevCdf(0);;
+	// Log-sum-exp over the components, no underflow far from the modes
+	template<typename TVector>
+	INLINE TFloat logPdfTempered(const TVector& x, const TFloat invTemperature) const {
+		// The forms are cheaper to recompute in the second pass than to store
+		const SimdType scale(TFloat(-0.5) * invTemperature);
+		SimdType maxLogs(LOG_ZERO);
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			maxLogs = max(maxLogs, fma(scale, packedQuadraticForm(x, j), SimdType::load(&mPackedLogBase[j])));
+		}
+		const TFloat maxLog = maxLogs.horizontalMax();
+		SimdType sum(TFloat(0));
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			sum = sum + exp(fma(scale, packedQuadraticForm(x, j), SimdType::load(&mPackedLogBase[j]) - SimdType(maxLog)));
+		}
+		return maxLog + log(sum.horizontalSum()) + BLOCKS * log(invTemperature);
+	}
+
+	// The tempered pdf depends on the state only through these per component quadratic forms (padded to the SIMD width)
+	template<typename TVector>
+	INLINE void quadraticForms(const TVector& x, std::vector<TFloat>& forms) const {
+		forms.resize(mPaddedCount);
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			packedQuadraticForm(x, j).storeUnaligned(&forms[j]);
+		}
+	}
+
+	INLINE TFloat logPdfTemperedFromForms(const std::vector<TFloat>& forms, const TFloat invTemperature) const {
+		assert(forms.size() == mPaddedCount);
+		const SimdType scale(TFloat(-0.5) * invTemperature);
+		SimdType maxLogs(LOG_ZERO);
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			maxLogs = max(maxLogs, fma(scale, SimdType::loadUnaligned(&forms[j]), SimdType::load(&mPackedLogBase[j])));
+		}
+		const TFloat maxLog = maxLogs.horizontalMax();
+		SimdType sum(TFloat(0));
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			sum = sum + exp(fma(scale, SimdType::loadUnaligned(&forms[j]), SimdType::load(&mPackedLogBase[j]) - SimdType(maxLog)));
+		}
+		return maxLog + log(sum.horizontalSum()) + BLOCKS * log(invTemperature);
+	}
+
+	// Every temperature in the same two sweeps over the components (maxima, then sums), each block of forms and log bases is
+	// loaded once for all of them. The lanes of the temperatures are kept in out, followed by the maxima, so a reused output
+	// allocates nothing. Equal to the single temperature version bit by bit
+	INLINE void logPdfTemperedFromForms(const std::vector<TFloat>& forms, const std::vector<TFloat>& invTemperatures, std::vector<TFloat>& out) const {
+		assert(forms.size() == mPaddedCount);
+		const size_t count = invTemperatures.size(), maxima = count * SimdType::WIDTH;
+		out.resize(maxima + count);
+		for (size_t t = 0; t < count; ++t) {
+			SimdType(LOG_ZERO).storeUnaligned(&out[t * SimdType::WIDTH]);
+		}
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			const SimdType form = SimdType::loadUnaligned(&forms[j]), logBase = SimdType::load(&mPackedLogBase[j]);
+			for (size_t t = 0; t < count; ++t) {
+				TFloat* lanes = &out[t * SimdType::WIDTH];
+				max(SimdType::loadUnaligned(lanes), fma(SimdType(TFloat(-0.5) * invTemperatures[t]), form, logBase)).storeUnaligned(lanes);
+			}
+		}
+		for (size_t t = 0; t < count; ++t) {
+			out[maxima + t] = SimdType::loadUnaligned(&out[t * SimdType::WIDTH]).horizontalMax();
+			SimdType(TFloat(0)).storeUnaligned(&out[t * SimdType::WIDTH]);
+		}
+		for (uint32_t j = 0; j < mPaddedCount; j += SimdType::WIDTH) {
+			const SimdType form = SimdType::loadUnaligned(&forms[j]), logBase = SimdType::load(&mPackedLogBase[j]);
+			for (size_t t = 0; t < count; ++t) {
+				TFloat* lanes = &out[t * SimdType::WIDTH];
+				(SimdType::loadUnaligned(lanes) + exp(fma(SimdType(TFloat(-0.5) * invTemperatures[t]), form, logBase - SimdType(out[maxima + t])))).storeUnaligned(lanes);
+			}
+		}
+		// The result of a temperature only overwrites lanes of it or of colder ones, which are already summed
+		for (size_t t = 0; t < count; ++t) {
+			const TFloat sum = SimdType::loadUnaligned(&out[t * SimdType::WIDTH]).horizontalSum();
+			out[t] = out[maxima + t] + log(sum) + BLOCKS * log(invTemperatures[t]);
+		}
+		out.resize(count);
+	}
+
+	INLINE TFloat highestPdf(const TFloat invTemperature) const {
+		TFloat highest(0), prevCdf(0);;
 		for (int i = 0; i < mDistributions.size(); ++i) {
 			highest = std::max(highest, mDistributions[i].highestPdf(invTemperature) * (mCdf[i] - prevCdf));
 			prevCdf = mCdf[i];
@@ -51,8 +173,8 @@ public:
 
 	template<typename TVector>
 	INLINE TVector sample(TVector rnd) const {
-		std::vector<Float>::const_iterator it;
-		Float pdf;
+		typename std::vector<TFloat>::const_iterator it;
+		TFloat pdf;
 		std::tie(it, pdf) = sampleDiscrete(mCdf.begin(), mCdf.end(), rnd[0]);
 		return mDistributions[it - mCdf.begin()].sample(rnd);
 	}
@@ -64,9 +186,9 @@ public:
 	template<typename TVector>
 	INLINE uint32_t mode(const TVector& x) const {
 		uint32_t m = modeCount();
-		Float prevCdf(0), maxP(0);
+		TFloat prevCdf(0), maxP(0);
 		for (int i = 0; i < mDistributions.size(); ++i) {
-			const Float p = mDistributions[i].pdf(x) * (mCdf[i] - prevCdf);
+			const TFloat p = mDistributions[i].pdf(x) * (mCdf[i] - prevCdf);
 			if (p > maxP) {
 				m = i;
 				maxP = p;
@@ -74,10 +196,24 @@ public:
 		}
 		return m;
 	}
+private:
+	// Quadratic forms of the components j, ..., j + SimdType::WIDTH - 1
+	template<typename TVector>
+	INLINE SimdType packedQuadraticForm(const TVector& x, const uint32_t j) const {
+		SimdType sum(TFloat(0));
+		for (uint32_t b = 0; b < BLOCKS; ++b) {
+			const SimdType dx = SimdType(x[2 * b]) - SimdType::load(&mPackedMean[(2 * b) * mPaddedCount + j]);
+			const SimdType dy = SimdType(x[2 * b + 1]) - SimdType::load(&mPackedMean[(2 * b + 1) * mPaddedCount + j]);
+			const TFloat* invSigma = &mPackedInvSigma[(3 * b) * mPaddedCount + j];
+			const SimdType dyTerm = SimdType::load(invSigma + mPaddedCount) * dy;
+			sum = fma(dx, fma(SimdType::load(invSigma), dx, dyTerm), fma(SimdType::load(invSigma + 2 * mPaddedCount) * dy, dy, sum));
+		}
+		return sum;
+	}
 };
 
-template<uint32_t TDimension>
-INLINE MixtureDistribution<NormalDistribution<TDimension>> randomMixture(
+template<uint32_t TDimension, typename TFloat = Float>
+INLINE MixtureDistribution<NormalDistribution<TDimension, TFloat>> randomMixture(
 	const uint32_t count, 
 	const Float minWeight, 
 	const Float maxWeight, 
@@ -86,29 +222,29 @@ INLINE MixtureDistribution<NormalDistribution<TDimension>> randomMixture(
 	const uint64_t seed) {
 	assert(count >= 1);
 	static_assert(TDimension >= 2, "Dimension must be divisible by 2");
-	std::vector<Float> weights;
+	std::vector<TFloat> weights;
 	weights.resize(count);
-	using Distribution = NormalDistribution<TDimension>;
-	using Vec = Vector<TDimension>;
-	using VecHalf = Vector<TDimension/2>;
+	using Distribution = NormalDistribution<TDimension, TFloat>;
+	using Vec = Vector<TDimension, TFloat>;
+	using VecHalf = Vector<TDimension/2, TFloat>;
 	std::vector<Distribution> distributions;
 	distributions.resize(count);
 	Pcg random(seed, 1337);
-	const Float dist = sqrt(avgScale);
+	const TFloat dist = TFloat(sqrt(avgScale));
 	std::vector<Vec> means(count);
 	nRooks(random, means);
 	for (uint32_t i = 0; i < count; ++i) {
-		weights[i] = minWeight + random() * (maxWeight - minWeight);
+		weights[i] = TFloat(minWeight + random.uniform<TFloat>() * (maxWeight - minWeight));
 		Vec scale;
 		for (uint32_t d = 0; d < TDimension / 2; ++d) {
-			const Float r = 1 + random() * diffScale;
+			const TFloat r = TFloat(1 + random.uniform<TFloat>() * diffScale);
 			scale[2 * d] = avgScale / r;
 			scale[2 * d + 1] = avgScale * r;
 		}
 		distributions[i] = Distribution(
 			Vec(dist * 3) + means[i] * Vec(1 - dist * 6),
 			scale,
-			VecHalf(0) + randomVector<TDimension/2>(random) * Float(2 * M_PI));
+			VecHalf(0) + randomVector<TDimension/2, TFloat>(random) * TFloat(2 * M_PI));
 	}
 	return MixtureDistribution<Distribution>(distributions, weights);
 ;}
@@ -3,92 +3,123 @@
 #include "Vector.h"
 #include "Matrix.h"
 
+template<typename TFloat = Float>
 class NormalDistribution2D {
-	Vector2 mMean;
-	Matrix2x2  mSigmaCholesky, mInvertedSigma;
-	Float mNormalization;
+	Vector<2, TFloat> mMean;
+	Matrix<2, 2, TFloat> mSigmaCholesky, mInvertedSigma;
+	TFloat mNormalization, mLogNormalization;
 public:
 	INLINE NormalDistribution2D() = default;
 
-	INLINE NormalDistribution2D(const Vector2 mean, const Vector2 scale, const Float rotationRadians) :mMean(mean) {
-		assert(scale[0] != Float(0) || scale[1] != Float(0));
-		const Float sinRot = sin(rotationRadians);
-		const Float cosRot = cos(rotationRadians);
-		const Matrix2x2 rotMatrix = makeMatrix2x2(cosRot, -sinRot, sinRot, cosRot);
-		const Matrix2x2 scaleMatrix = makeMatrix2x2(scale[0], Float(0), Float(0), scale[1]);
-		const Matrix2x2 sigma = invert(rotMatrix) * scaleMatrix * rotMatrix;
-		const Float det = determinant(sigma);
-		assert(det > Float(0));
+	INLINE NormalDistribution2D(const Vector<2, TFloat> mean, const Vector<2, TFloat> scale, const TFloat rotationRadians) :mMean(mean) {
+		assert(scale[0] != TFloat(0) || scale[1] != TFloat(0));
+		const TFloat sinRot = sin(rotationRadians);
+		const TFloat cosRot = cos(rotationRadians);
+		const Matrix<2, 2, TFloat> rotMatrix = makeMatrix2x2(cosRot, -sinRot, sinRot, cosRot);
+		const Matrix<2, 2, TFloat> scaleMatrix = makeMatrix2x2(scale[0], TFloat(0), TFloat(0), scale[1]);
+		const Matrix<2, 2, TFloat> sigma = invert(rotMatrix) * scaleMatrix * rotMatrix;
+		const TFloat det = determinant(sigma);
+		assert(det > TFloat(0));
 		mInvertedSigma = invert(sigma);
-		mNormalization = Float(2 * M_PI) * sqrt(det);
+		mNormalization = TFloat(2 * M_PI) * sqrt(det);
+		mLogNormalization = log(mNormalization);
 		mSigmaCholesky = cholesky(sigma);
 	}
 
-	INLINE Float pdf(const Vector2 x) const {
-		const Vector2 rel = x - mMean;
-		const Float expArg = -0.5f * dot(rel, mInvertedSigma * rel);
+	INLINE TFloat pdf(const Vector<2, TFloat> x) const {
+		const Vector<2, TFloat> rel = x - mMean;
+		const TFloat expArg = -0.5f * dot(rel, mInvertedSigma * rel);
 		return exp(expArg) / mNormalization;
 	}
 
-	INLINE Float pdfTempered(const Vector2 x, const Float invTemperature) const {
-		const Vector2 rel = x - mMean;
-		const Float expArg = -0.5f * dot(rel, mInvertedSigma * rel) * invTemperature;
+	INLINE TFloat pdfTempered(const Vector<2, TFloat> x, const TFloat invTemperature) const {
+		const Vector<2, TFloat> rel = x - mMean;
+		const TFloat expArg = -0.5f * dot(rel, mInvertedSigma * rel) * invTemperature;
 		return exp(expArg) / mNormalization * invTemperature;
 	}
 	
-	INLINE Float highestPdf(const Float invTemperature) const {
+	INLINE TFloat logNormalization() const {
+		return mLogNormalization;
+	}
+
+	INLINE Vector<2, TFloat> mean() const {
+		return mMean;
+	}
+
+	INLINE Matrix<2, 2, TFloat> invertedSigma() const {
+		return mInvertedSigma;
+	}
+
+	INLINE TFloat highestPdf(const TFloat invTemperature) const {
 		return invTemperature / mNormalization;
 	}
 
-	INLINE Vector2 sample(const Vector2 rnd) const {
+	INLINE Vector<2, TFloat> sample(const Vector<2, TFloat> rnd) const {
 		assert(1.f - rnd[0] > 0.f);
-		const Float scale = sqrt(-2.f * log(1.f - rnd[0]));
-		const Float angle = Float(2 * M_PI) * rnd[1];
+		const TFloat scale = sqrt(-2.f * log(1.f - rnd[0]));
+		const TFloat angle = TFloat(2 * M_PI) * rnd[1];
 		return mSigmaCholesky * (makeVector2(cos(angle), sin(angle)) * scale) + mMean;
 	}
 };
 
-template<uint32_t TDim>
+template<uint32_t TDim, typename TFloat = Float>
 class NormalDistribution {
 	static_assert(TDim >= 2 && TDim % 2 ==0, "Dimension must be positive and divisible by two");
-	NormalDistribution2D mSubDistributions[TDim / 2];
+	NormalDistribution2D<TFloat> mSubDistributions[TDim / 2];
+	TFloat mLogNormalization;
 public:
+	static constexpr uint32_t DIMENSION = TDim;
+	using FloatType = TFloat;
+
 	INLINE NormalDistribution() = default;
 
-	INLINE NormalDistribution(const Vector<TDim>& mean, const Vector<TDim>& scale, const Vector<TDim / 2>& rotationRadians) {
+	INLINE NormalDistribution(const Vector<TDim, TFloat>& mean, const Vector<TDim, TFloat>& scale, const Vector<TDim / 2, TFloat>& rotationRadians) {
 		for (int i = 0; i < TDim / 2; ++i) {
-			mSubDistributions[i] = NormalDistribution2D(pickVector2(mean, 2 * i), pickVector2(scale, 2 * i), rotationRadians[i]);
+			mSubDistributions[i] = NormalDistribution2D<TFloat>(pickVector2(mean, 2 * i), pickVector2(scale, 2 * i), rotationRadians[i]);
+		}
+		mLogNormalization = TFloat(0);
+		for (int i = 0; i < TDim / 2; ++i) {
+			mLogNormalization += mSubDistributions[i].logNormalization();
 		}
 	}
 
-	INLINE Float pdf(const Vector<TDim>& x) const {
-		Float product = Float(1);
+	INLINE TFloat pdf(const Vector<TDim, TFloat>& x) const {
+		TFloat product = TFloat(1);
 		for (int i = 0; i < TDim / 2; ++i) {
 			product *= mSubDistributions[i].pdf(pickVector2(x, 2 * i));
 		}
 		return product;
 	}
 
-	INLINE Float pdfTempered(const Vector<TDim>& x, const Float invTemperature) const {
-		Float product = Float(1);
+	INLINE TFloat pdfTempered(const Vector<TDim, TFloat>& x, const TFloat invTemperature) const {
+		TFloat product = TFloat(1);
 		for (int i = 0; i < TDim / 2; ++i) {
 			product *= mSubDistributions[i].pdfTempered(pickVector2(x, 2 * i), invTemperature);
 		}
 		return product;
 	}
 
-	INLINE Float highestPdf(const Float invTemperature) const {
-		Float product = Float(1);
+	INLINE TFloat logNormalization() const {
+		return mLogNormalization;
+	}
+
+	// Independent 2D distribution of the dimensions 2 * index and 2 * index + 1
+	INLINE const NormalDistribution2D<TFloat>& block(const uint32_t index) const {
+		return mSubDistributions[index];
+	}
+
+	INLINE TFloat highestPdf(const TFloat invTemperature) const {
+		TFloat product = TFloat(1);
 		for (int i = 0; i < TDim / 2; ++i) {
 			product *= mSubDistributions[i].highestPdf(invTemperature);
 		}
 		return product;
 	}
 
-	INLINE Vector<TDim> sample(const Vector<TDim>& rnd) const {
-		Vector<TDim> result;
+	INLINE Vector<TDim, TFloat> sample(const Vector<TDim, TFloat>& rnd) const {
+		Vector<TDim, TFloat> result;
 		for (int i = 0; i < TDim / 2; ++i) {
-			Vector2 temp = mSubDistributions[i].sample(pickVector2(rnd, 2 * i));
+			Vector<2, TFloat> temp = mSubDistributions[i].sample(pickVector2(rnd, 2 * i));
 			result[2 * i] = temp[0];
 			result[2 * i + 1] = temp[1];
 		}
@@ -0,0 +1,177 @@
+#pragma once
+#include "Config.h"
+#include <stdint.h>
+#include <vector>
+#include <cassert>
+
+// Multiset ordered by operator< with rank queries: a treap whose nodes keep their subtree sizes, so insertion, removal
+// by rank, the rank of a value and the element of a rank all take O(log n) expected. The nodes live in one vector with
+// a free list, the priorities come from an internal generator so the tree never touches the caller's random streams
+template<typename T>
+class OrderStatisticTree {
+	static constexpr uint32_t NIL = ~0u;
+	struct Node {
+		T value;
+		uint32_t left, right, size, priority;
+	};
+	std::vector<Node> mNodes;
+	std::vector<uint32_t> mFree;
+	uint32_t mRoot;
+	uint32_t mPriorityState;
+public:
+	OrderStatisticTree() : mRoot(NIL), mPriorityState(0x9E3779B9u) {}
+
+	INLINE size_t size() const {
+		return mRoot == NIL ? 0 : mNodes[mRoot].size;
+	}
+
+	// Allocated, including the free list
+	INLINE size_t bytes() const {
+		return mNodes.capacity() * sizeof(Node) + mFree.capacity() * sizeof(uint32_t);
+	}
+
+	INLINE void clear() {
+		mNodes.clear();
+		mFree.clear();
+		mRoot = NIL;
+	}
+
+	// Clears and frees the storage
+	void release() {
+		std::vector<Node>().swap(mNodes);
+		std::vector<uint32_t>().swap(mFree);
+		mRoot = NIL;
+	}
+
+	// After the elements it compares equal to
+	void add(const T& value) {
+		uint32_t node;
+		if (mFree.empty()) {
+			node = uint32_t(mNodes.size());
+			mNodes.emplace_back();
+		}
+		else {
+			node = mFree.back();
+			mFree.pop_back();
+		}
+		mNodes[node].value = value;
+		mNodes[node].left = mNodes[node].right = NIL;
+		mNodes[node].size = 1;
+		mNodes[node].priority = nextPriority();
+		uint32_t lower, upper;
+		splitAfter(mRoot, value, lower, upper);
+		mRoot = merge(merge(lower, node), upper);
+	}
+
+	void removeAt(const size_t rank) {
+		assert(rank < size());
+		uint32_t lower, rest, node, upper;
+		splitRank(mRoot, uint32_t(rank), lower, rest);
+		splitRank(rest, 1, node, upper);
+		mFree.push_back(node);
+		mRoot = merge(lower, upper);
+	}
+
+	const T& get(size_t rank) const {
+		assert(rank < size());
+		uint32_t node = mRoot;
+		while (true) {
+			const uint32_t leftSize = sizeOf(mNodes[node].left);
+			if (rank < leftSize) {
+				node = mNodes[node].left;
+			}
+			else if (rank == leftSize) {
+				return mNodes[node].value;
+			}
+			else {
+				rank -= leftSize + 1;
+				node = mNodes[node].right;
+			}
+		}
+	}
+
+	// Number of elements less than the value, the rank of the first one not less
+	size_t lowerRank(const T& value) const {
+		size_t rank = 0;
+		for (uint32_t node = mRoot; node != NIL;) {
+			if (mNodes[node].value < value) {
+				rank += sizeOf(mNodes[node].left) + 1;
+				node = mNodes[node].right;
+			}
+			else {
+				node = mNodes[node].left;
+			}
+		}
+		return rank;
+	}
+
+private:
+	INLINE uint32_t sizeOf(const uint32_t node) const {
+		return node == NIL ? 0 : mNodes[node].size;
+	}
+
+	INLINE void update(const uint32_t node) {
+		mNodes[node].size = 1 + sizeOf(mNodes[node].left) + sizeOf(mNodes[node].right);
+	}
+
+	// Xorshift, only the shape of the tree depends on it
+	INLINE uint32_t nextPriority() {
+		mPriorityState ^= mPriorityState << 13;
+		mPriorityState ^= mPriorityState >> 17;
+		mPriorityState ^= mPriorityState << 5;
+		return mPriorityState;
+	}
+
+	// Every element of lower precedes every element of upper
+	uint32_t merge(const uint32_t lower, const uint32_t upper) {
+		if (lower == NIL) {
+			return upper;
+		}
+		if (upper == NIL) {
+			return lower;
+		}
+		if (mNodes[lower].priority > mNodes[upper].priority) {
+			mNodes[lower].right = merge(mNodes[lower].right, upper);
+			update(lower);
+			return lower;
+		}
+		mNodes[upper].left = merge(lower, mNodes[upper].left);
+		update(upper);
+		return upper;
+	}
+
+	// lower gets the elements not greater than the value
+	void splitAfter(const uint32_t node, const T& value, uint32_t& lower, uint32_t& upper) {
+		if (node == NIL) {
+			lower = upper = NIL;
+			return;
+		}
+		if (value < mNodes[node].value) {
+			splitAfter(mNodes[node].left, value, lower, mNodes[node].left);
+			upper = node;
+		}
+		else {
+			splitAfter(mNodes[node].right, value, mNodes[node].right, upper);
+			lower = node;
+		}
+		update(node);
+	}
+
+	// lower gets the first count elements
+	void splitRank(const uint32_t node, const uint32_t count, uint32_t& lower, uint32_t& upper) {
+		if (node == NIL) {
+			lower = upper = NIL;
+			return;
+		}
+		const uint32_t leftSize = sizeOf(mNodes[node].left);
+		if (count <= leftSize) {
+			splitRank(mNodes[node].left, count, lower, mNodes[node].left);
+			upper = node;
+		}
+		else {
+			splitRank(mNodes[node].right, count - leftSize - 1, mNodes[node].right, upper);
+			lower = node;
+		}
+		update(node);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+#include "Config.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Barrier of a fixed group of threads, they spin (yielding) instead of sleeping as the phases between the waits are short
+class SpinBarrier {
+	const uint32_t mCount;
+	std::atomic<uint32_t> mWaiting, mGeneration;
+public:
+	INLINE SpinBarrier(const uint32_t count) : mCount(count), mWaiting(0), mGeneration(0) {}
+
+	INLINE void wait() {
+		const uint32_t generation = mGeneration.load(std::memory_order_acquire);
+		if (mWaiting.fetch_add(1, std::memory_order_acq_rel) + 1 == mCount) {
+			mWaiting.store(0, std::memory_order_relaxed);
+			mGeneration.fetch_add(1, std::memory_order_release);
+		}
+		else {
+			while (mGeneration.load(std::memory_order_acquire) == generation) {
+				std::this_thread::yield();
+			}
+		}
+	}
+};
+
+// Persistent pool of worker threads, the calling thread takes part in the work as thread 0
+class ThreadPool {
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mStart, mDone;
+	std::function<void(uint32_t, uint32_t)> mTask;
+	std::atomic<uint32_t> mNext;
+	uint32_t mCount, mGeneration, mBusy;
+	bool mStop;
+public:
+	// Zero thread count means one thread per hardware thread
+	INLINE ThreadPool(uint32_t threadCount) : mNext(0), mCount(0), mGeneration(0), mBusy(0), mStop(false) {
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (uint32_t t = 1; t < threadCount; ++t) {
+			mWorkers.emplace_back([this, t]() { workerLoop(t); });
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	INLINE ~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mStart.notify_all();
+		for (std::thread& worker : mWorkers) {
+			worker.join();
+		}
+	}
+
+	INLINE uint32_t threadCount() const {
+		return uint32_t(mWorkers.size()) + 1;
+	}
+
+	// Calls func(index, threadIndex) for every index in [0, count) and waits until all calls are finished
+	template<typename TFunc>
+	void parallelFor(const uint32_t count, const TFunc& func) {
+		if (mWorkers.empty()) {
+			for (uint32_t i = 0; i < count; ++i) {
+				func(i, 0);
+			}
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mTask = func;
+			mCount = count;
+			mNext = 0;
+			mBusy = uint32_t(mWorkers.size());
+			++mGeneration;
+		}
+		mStart.notify_all();
+		work(0);
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this]() { return mBusy == 0; });
+	}
+private:
+	INLINE void work(const uint32_t threadIndex) {
+		for (uint32_t i = mNext++; i < mCount; i = mNext++) {
+			mTask(i, threadIndex);
+		}
+	}
+
+	void workerLoop(const uint32_t threadIndex) {
+		uint32_t generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mStart.wait(lock, [this, generation]() { return mStop || mGeneration != generation; });
+				if (mStop) {
+					return;
+				}
+				generation = mGeneration;
+			}
+			work(threadIndex);
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (--mBusy == 0) {
+				mDone.notify_one();
+			}
+		}
+	}
+};
+
+// Counter for many threads that read it rarely: every thread adds atomically to its own cache line, taken in turn as the
+// threads first count, so the additions are uncontended up to SHARDS threads. A copy starts from zero, the counts belong
+// to the object
+class ShardedCounter {
+	static constexpr uint32_t SHARDS = 64;
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> value;
+	};
+	Shard mShards[SHARDS];
+public:
+	INLINE ShardedCounter() {
+		clear();
+	}
+
+	INLINE ShardedCounter(const ShardedCounter&) : ShardedCounter() {}
+
+	INLINE ShardedCounter& operator=(const ShardedCounter&) {
+		return *this;
+	}
+
+	INLINE void add(const uint64_t count) {
+		mShards[threadShard()].value.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	INLINE uint64_t value() const {
+		uint64_t result = 0;
+		for (const Shard& shard : mShards) {
+			result += shard.value.load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	INLINE void clear() {
+		for (Shard& shard : mShards) {
+			shard.value.store(0, std::memory_order_relaxed);
+		}
+	}
+private:
+	// Order of the thread among the counting ones modulo SHARDS. Kept one higher so that zero means not yet assigned, a
+	// constant initial value spares the guard of every access
+	INLINE static uint32_t threadShard() {
+		static std::atomic<uint32_t> next(0);
+		thread_local uint32_t shard = 0;
+		if (shard == 0) {
+			shard = next.fetch_add(1, std::memory_order_relaxed) % SHARDS + 1;
+		}
+		return shard - 1;
+	}
+};
@@ -1,30 +1,48 @@
 #pragma once
 #include "Algorithm.h"
 #include "LocalMutation.h"
+#include "Parallel.h"
+#include <memory>
 
-template<uint32_t TDimension>
-class ParallelTemperingAlgorithm : public Algorithm<TDimension> {
+enum class ParallelTemperingType {
+	SEQUENTIAL = 0, // Every chain attempts a swap with the next one right after its step
+	DEO = 1 // The chains step concurrently, then the even or the odd neighbour pairs (alternately) attempt swaps
+};
+
+template<uint32_t TDimension, typename TFloat = Float>
+class ParallelTemperingAlgorithm : public Algorithm<TDimension, TFloat> {
+	using Signature = typename Integrand<TDimension, TFloat>::StateSignature;
 	struct Chain {
-		LocalMutation<TDimension>* mutator;
-		Float invTemperature;
+		LocalMutation<TDimension, TFloat>* mutator;
+		TFloat invTemperature;
 		Pcg random;
+		PcgLanes randomLanes; // Large steps
 		int swapAttempts, swaps;
+		Signature signature, proposedSignature; // Current state and the scratch space for proposals
 	};
 	std::vector<Chain> chains;
-	Float mLargeStepProb;
+	TFloat mLargeStepProb;
+	ParallelTemperingType mType;
 public:
-	INLINE ParallelTemperingAlgorithm(const Integrand<TDimension>& integrand, std::vector<Float> temperatures) : Algorithm<TDimension>(integrand) {
+	// The threads only apply to the DEO type, zero means all hardware threads (see setPool for the test suite). The results
+	// do not depend on the thread count
+	INLINE ParallelTemperingAlgorithm(const Integrand<TDimension, TFloat>& integrand, std::vector<Float> temperatures,
+		const ParallelTemperingType type = ParallelTemperingType::SEQUENTIAL, const uint32_t threadCount = 1) : Algorithm<TDimension, TFloat>(integrand), mType(type) {
+		this->checkChainCount(temperatures.size());
 		mLargeStepProb = 0.3f;
+		if (mType == ParallelTemperingType::DEO) {
+			this->setThreadCount(threadCount);
+		}
 		std::sort(temperatures.begin(), temperatures.end());
 		assert(temperatures.size() > 0 && temperatures[0] == 1.f);
 		chains.resize(temperatures.size());
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			chains[i].invTemperature = 1.f / temperatures[i];
-			chains[i].random.reset(1337 * i + 235, 1579 * i + 454);
-			chains[i].mutator = new LocalMutation<TDimension>(chains[i].random);
+			chains[i].mutator = new LocalMutation<TDimension, TFloat>(chains[i].random);
 			chains[i].swapAttempts = 0;
 			chains[i].swaps = 0;
 		}
+		seed(Pcg(0xDEAD));
 	}
 
 	virtual ~ParallelTemperingAlgorithm() override {
@@ -33,42 +51,25 @@ public:
 		}
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			do {
-				chains[i].mutator->setState(randomVector<TDimension>(chains[i].random));
-			} while (value(chains[i].mutator->getState(), i) == Float(0));
+				const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(chains[i].random);
+				chains[i].mutator->setState(state, logValue(state, i));
+			} while (exp(chains[i].mutator->getLogValue()) == TFloat(0)); // Start where the value does not underflow
 			chains[i].mutator->startAdaptation(0.3f);
+			this->mIntegrand.signature(chains[i].mutator->getState(), chains[i].signature);
+		}
+		if (mType == ParallelTemperingType::DEO) {
+			runDeo(samples);
+			return;
 		}
 		
 		for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
 			for (int c = int(chains.size()) - 1; c >= 0; --c) {
-				const bool localStep = i % 3 != 0;
-				Vector<TDimension> proposed;
-				if (localStep) {
-					proposed = chains[c].mutator->mutateState();
-				}
-				else {
-					proposed = randomVector<TDimension>(chains[c].random);
-				}
-				if (acceptRatio(chains[c].mutator->getState(), proposed, c) > chains[c].random()) {
-					chains[c].mutator->mutationWasAccepted(proposed, localStep);
-				}
-				else {
-					chains[c].mutator->mutationWasRejected(localStep);
-				}
-				if (c == 0 && i >= MCMC_BURN_PERIOD) {
-					const uint32_t index = i - MCMC_BURN_PERIOD;
-					samples[index].sample = chains[c].mutator->getState();
-					samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
-				}
+				step(c, i, samples);
 				++chains[c].swapAttempts;
-				if (c != chains.size() - 1 && swapRatio(c, c + 1) > chains[c].random()) {
-					++chains[c].swaps;
-					auto temp = chains[c].mutator->getState();
-					chains[c].mutator->setState(chains[c+1].mutator->getState());
-					chains[c + 1].mutator->setState(temp);
-				}
+				attemptSwap(c);
 			}
 		}
 	}
@@ -78,6 +79,9 @@ public:
 	}
 
 	virtual std::string name() const override {
+		if (mType == ParallelTemperingType::DEO) {
+			return "ParallelTempering - DEO";
+		}
 		return sName();
 	}
 
@@ -85,30 +89,117 @@ public:
 
 	virtual void printStats() const override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
-			std::cout << "#" << (i+1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << Float(100) * chains[i].mutator->acceptanceRate() 
-				<< " % Swap rate: " << Float(100) * (chains[i].swaps / Float(chains[i].swapAttempts)) << " %" << std::endl;
+			std::cout << "#" << (i+1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << TFloat(100) * chains[i].mutator->acceptanceRate() 
+				<< " % Swap rate: " << TFloat(100) * (chains[i].swaps / TFloat(std::max(1, chains[i].swapAttempts))) << " %" << std::endl;
+		}
+	}
+
+	virtual void seed(const Pcg& stream) override {
+		Algorithm<TDimension, TFloat>::seed(stream);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			const Pcg chain = this->chainStream(stream, i);
+			chains[i].random = chain.stream(0, PCG_GENERATOR_STREAM);
+			chains[i].randomLanes.reset(chain, 1, PCG_GENERATOR_STREAM);
+		}
+	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		const ParallelTemperingAlgorithm& algorithm = static_cast<const ParallelTemperingAlgorithm&>(other);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			chains[i].mutator->mergeStats(*algorithm.chains[i].mutator);
+			chains[i].swapAttempts += algorithm.chains[i].swapAttempts;
+			chains[i].swaps += algorithm.chains[i].swaps;
 		}
 	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed, const uint32_t chainNo) const {
-		const Float valCurr = this->mIntegrand.value(current, chains[chainNo].invTemperature);
-		const Float valProp = this->mIntegrand.value(proposed, chains[chainNo].invTemperature);
-		return valCurr > Float(0) ? std::min(Float(1), valProp / valCurr) : Float(1);
-	}
-
-	INLINE Float swapRatio(const uint32_t chain1, const uint32_t chain2) const {
-		const auto state1 = chains[chain1].mutator->getState();
-		const auto state2 = chains[chain2].mutator->getState();
-		const Float val1_t1 = this->mIntegrand.value(state1, chains[chain1].invTemperature);
-		const Float val1_t2 = this->mIntegrand.value(state1, chains[chain2].invTemperature);
-		const Float val2_t1 = this->mIntegrand.value(state2, chains[chain1].invTemperature);
-		const Float val2_t2 = this->mIntegrand.value(state2, chains[chain2].invTemperature);
-		const Float factor1 = val1_t2 / val1_t1;
-		const Float factor2 = val2_t1 / val2_t2;
-		return std::min(Float(1), factor1 * factor2);
-	}
-
-	INLINE Float value(const Vector<TDimension>& state, const uint32_t chainNo) const {
-		return this->mIntegrand.value(state, chains[chainNo].invTemperature);
+	// The chains are split among the threads, the barriers separate the steps from the swaps. Every chain and every
+	// pair uses only its own random generators, so the result is the same for any thread count
+	void runDeo(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) {
+		ThreadPool* pool = this->pool();
+		const uint32_t threadCount = pool ? pool->threadCount() : 1;
+		const uint32_t steps = uint32_t(samples.size()) + MCMC_BURN_PERIOD;
+		SpinBarrier barrier(threadCount);
+		const auto work = [&](const uint32_t thread) {
+			for (uint32_t i = 0; i < steps; ++i) {
+				for (uint32_t c = thread; c < uint32_t(chains.size()); c += threadCount) {
+					step(c, i, samples);
+				}
+				barrier.wait();
+				// Pair (c, c + 1) for c of the parity of the step
+				for (uint32_t c = (i & 1) + 2 * thread; c + 1 < uint32_t(chains.size()); c += 2 * threadCount) {
+					++chains[c].swapAttempts;
+					attemptSwap(c);
+				}
+				barrier.wait();
+			}
+		};
+		if (pool) {
+			pool->parallelFor(threadCount, [&work](const uint32_t index, const uint32_t) { work(index); });
+		}
+		else {
+			work(0);
+		}
+	}
+
+	// Metropolis step of one chain, the first chain records the sample after the burn in period
+	INLINE void step(const uint32_t c, const uint32_t i, std::vector<SampleAndPdf<TDimension, TFloat>>& samples) {
+		const bool localStep = i % 3 != 0;
+		Vector<TDimension, TFloat> proposed;
+		if (localStep) {
+			proposed = chains[c].mutator->mutateState();
+		}
+		else {
+			proposed = randomVector<TDimension, TFloat>(chains[c].randomLanes);
+		}
+		this->mIntegrand.signature(proposed, chains[c].proposedSignature);
+		const TFloat logProposed = logValue(chains[c].proposedSignature, c);
+		if (acceptRatio(c, logProposed) > chains[c].random()) {
+			chains[c].mutator->mutationWasAccepted(proposed, logProposed, localStep);
+			std::swap(chains[c].signature, chains[c].proposedSignature);
+		}
+		else {
+			chains[c].mutator->mutationWasRejected(localStep);
+		}
+		if (c == 0 && i >= MCMC_BURN_PERIOD) {
+			const uint32_t index = i - MCMC_BURN_PERIOD;
+			samples[index].sample = chains[c].mutator->getState();
+			samples[index].pdf = exp(chains[c].mutator->getLogValue()); // The first chain has temperature one
+		}
+	}
+
+	// Swap of the chain with the next one, decided by the random generator of the chain
+	INLINE void attemptSwap(const uint32_t c) {
+		TFloat log1_t2, log2_t1;
+		if (c != chains.size() - 1 && swapRatio(c, c + 1, log1_t2, log2_t1) > chains[c].random()) {
+			++chains[c].swaps;
+			swapStates(c, c + 1, log1_t2, log2_t1);
+		}
+	}
+
+	INLINE TFloat acceptRatio(const uint32_t chainNo, const TFloat logProposed) const {
+		const TFloat logCurr = chains[chainNo].mutator->getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
+	}
+
+	// Only the exchanged values are evaluated, they are returned for swapStates
+	INLINE TFloat swapRatio(const uint32_t chain1, const uint32_t chain2, TFloat& log1_t2, TFloat& log2_t1) const {
+		log1_t2 = logValue(chains[chain1].signature, chain2);
+		log2_t1 = logValue(chains[chain2].signature, chain1);
+		return ratioFromLog((log1_t2 - chains[chain1].mutator->getLogValue()) + (log2_t1 - chains[chain2].mutator->getLogValue()));
+	}
+
+	INLINE void swapStates(const uint32_t chain1, const uint32_t chain2, const TFloat log1_t2, const TFloat log2_t1) {
+		const Vector<TDimension, TFloat> temp = chains[chain1].mutator->getState();
+		chains[chain1].mutator->setState(chains[chain2].mutator->getState(), log2_t1);
+		chains[chain2].mutator->setState(temp, log1_t2);
+		std::swap(chains[chain1].signature, chains[chain2].signature);
+	}
+
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& state, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(state, chains[chainNo].invTemperature);
+	}
+
+	INLINE TFloat logValue(const Signature& signature, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(signature, chains[chainNo].invTemperature);
 	}
 };
\ No newline at end of file
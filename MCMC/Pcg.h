@@ -1,8 +1,32 @@
 #pragma once
 #include "Config.h"
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 // *Really* minimal PCG32 code / (c) 2014 M.E. O'Neill / pcg-random.org
 // Licensed under Apache License 2.0 (NO WARRANTY, etc. see website)
 
+// Lengths (as powers of two) of the nested substreams of one sequence: 2^10 runs, each split into
+// 2^8 chains, each split into 2^8 generators of 2^38 numbers
+constexpr uint32_t PCG_RUN_STREAM = 54;
+constexpr uint32_t PCG_CHAIN_STREAM = 46;
+constexpr uint32_t PCG_GENERATOR_STREAM = 38;
+// Blocks of every level, the first chain block of a run belongs to the algorithm. Nothing outside a block is checked by
+// stream(), the users of the levels check these
+constexpr uint64_t PCG_MAX_RUNS = uint64_t(1) << (64 - PCG_RUN_STREAM);
+constexpr uint32_t PCG_MAX_CHAINS = (1u << (PCG_RUN_STREAM - PCG_CHAIN_STREAM)) - 1;
+constexpr uint32_t PCG_GENERATORS = 1u << (PCG_CHAIN_STREAM - PCG_GENERATOR_STREAM);
+
+// Uniform number in [0, 1) from 32 random bits, floats keep the top 24 bits so they cannot round up to one
+template<typename TFloat>
+INLINE TFloat uniformFromBits(const uint32_t bits) {
+	if constexpr (sizeof(TFloat) == sizeof(float)) {
+		return TFloat(bits >> 8) * TFloat(1.0 / 16777216.0);
+	} else {
+		return bits * TFloat(1.0 / 4294967296.0);
+	}
+}
+
 class Pcg {
 	uint64_t mState;  
 	uint64_t mInc;
@@ -19,8 +43,14 @@ public:
 		uint();
 	}
 
+	// Multiplying by 2^-32 is exact and cheaper than a divide, the result is in [0, 1)
 	INLINE Float operator()() {
-		return uint() / Float(UINT32_MAX);
+		return uniform<Float>();
+	}
+
+	template<typename TFloat>
+	INLINE TFloat uniform() {
+		return uniformFromBits<TFloat>(uint());
 	}
 
 	INLINE uint32_t uint() {
@@ -33,6 +63,45 @@ public:
 		return (xorshifted >> rot) | (xorshifted << (uint32_t(-int32_t(rot)) & 31));
 	}
 
+	// Skips delta numbers in O(log delta), the LCG step is composed with itself by squaring
+	INLINE void advance(uint64_t delta) {
+		uint64_t curMult = 6364136223846793005ULL, curPlus = mInc | 1;
+		uint64_t accMult = 1, accPlus = 0;
+		while (delta > 0) {
+			if (delta & 1) {
+				accMult *= curMult;
+				accPlus = accPlus * curMult + curPlus;
+			}
+			curPlus = (curMult + 1) * curPlus;
+			curMult *= curMult;
+			delta >>= 1;
+		}
+		mState = accMult * mState + accPlus;
+	}
+
+	// The index-th block of 2^log2Length numbers from here, blocks of different indices never overlap
+	INLINE Pcg stream(const uint64_t index, const uint32_t log2Length) const {
+		assert(log2Length < 64 && index < (uint64_t(1) << (64 - log2Length)));
+		Pcg result(*this);
+		result.advance(index << log2Length);
+		return result;
+	}
+
+	// Hands the next 2^log2Length numbers to the returned generator and continues behind them
+	INLINE Pcg split(const uint32_t log2Length) {
+		const Pcg result(*this);
+		advance(uint64_t(1) << log2Length);
+		return result;
+	}
+
+	INLINE uint64_t state() const {
+		return mState;
+	}
+
+	INLINE uint64_t increment() const {
+		return mInc;
+	}
+
 	INLINE uint32_t uint(const uint32_t limit) {
 		const uint32_t end = (UINT32_MAX / limit) * limit;
 		uint32_t value = uint();
@@ -42,4 +111,202 @@ public:
 		return value % limit;
 	}
 
+};
+
+// Independent PCG32 streams advanced together in SIMD registers (one AVX-512 or two AVX2 registers)
+class PcgLanes {
+public:
+	static constexpr uint32_t LANES = 8;
+private:
+	static constexpr uint64_t MULTIPLIER = 6364136223846793005ULL;
+	alignas(64) uint64_t mState[LANES];
+	alignas(64) uint64_t mInc[LANES];
+	alignas(64) uint32_t mBuffer[LANES]; // Generated but not yet used values
+	uint32_t mBufferPosition;
+public:
+	INLINE PcgLanes(const uint64_t initstate = 1337, const uint64_t initseq = 1) {
+		reset(initstate, initseq);
+	}
+
+	INLINE PcgLanes(const Pcg& base, const uint64_t firstStream, const uint32_t log2Length) {
+		reset(base, firstStream, log2Length);
+	}
+
+	// Lane l uses the sequence initseq * LANES + l, so the lanes of different sequences never coincide
+	INLINE void reset(const uint64_t initstate = 1337, const uint64_t initseq = 1) {
+		for (uint32_t l = 0; l < LANES; ++l) {
+			Pcg lane(initstate, initseq * LANES + l);
+			mState[l] = lane.state();
+			mInc[l] = lane.increment();
+		}
+		mBufferPosition = LANES;
+	}
+
+	// Lane l is the substream firstStream + l of base
+	INLINE void reset(const Pcg& base, const uint64_t firstStream, const uint32_t log2Length) {
+		for (uint32_t l = 0; l < LANES; ++l) {
+			const Pcg lane = base.stream(firstStream + l, log2Length);
+			mState[l] = lane.state();
+			mInc[l] = lane.increment();
+		}
+		mBufferPosition = LANES;
+	}
+
+	INLINE uint32_t uint() {
+		if (mBufferPosition == LANES) {
+			next(mBuffer);
+			mBufferPosition = 0;
+		}
+		return mBuffer[mBufferPosition++];
+	}
+
+	INLINE Float operator()() {
+		return uniform<Float>();
+	}
+
+	template<typename TFloat>
+	INLINE TFloat uniform() {
+		return uniformFromBits<TFloat>(uint());
+	}
+
+	// n uniform numbers in [0, 1), whole blocks of lanes are converted in registers
+	INLINE void fill(double* out, uint32_t n) {
+		for (; n > 0 && mBufferPosition < LANES; --n) {
+			*out++ = mBuffer[mBufferPosition++] * (1.0 / 4294967296.0);
+		}
+		for (; n >= LANES; n -= LANES, out += LANES) {
+			nextDoubles(out);
+		}
+		if (n > 0) {
+			// The rest of the block stays in the buffer
+			next(mBuffer);
+			for (mBufferPosition = 0; mBufferPosition < n; ++mBufferPosition) {
+				out[mBufferPosition] = mBuffer[mBufferPosition] * (1.0 / 4294967296.0);
+			}
+		}
+	}
+
+	// The same numbers as uniform<float>(), the top 24 bits of whole blocks are converted in registers
+	INLINE void fill(float* out, uint32_t n) {
+		for (; n > 0 && mBufferPosition < LANES; --n) {
+			*out++ = uniformFromBits<float>(mBuffer[mBufferPosition++]);
+		}
+		for (; n >= LANES; n -= LANES, out += LANES) {
+			nextFloats(out);
+		}
+		if (n > 0) {
+			next(mBuffer);
+			for (mBufferPosition = 0; mBufferPosition < n; ++mBufferPosition) {
+				out[mBufferPosition] = uniformFromBits<float>(mBuffer[mBufferPosition]);
+			}
+		}
+	}
+
+	// One value of every lane
+	INLINE void next(uint32_t* out) {
+		alignas(64) uint64_t outputs[LANES];
+		step(outputs);
+		for (uint32_t l = 0; l < LANES; ++l) {
+			out[l] = uint32_t(outputs[l]);
+		}
+	}
+private:
+#if defined(__AVX512F__)
+	// Low 64 bits of a * MULTIPLIER from 32-bit products
+	static INLINE __m512i multiply(const __m512i a) {
+		const __m512i low = _mm512_set1_epi64(MULTIPLIER & 0xFFFFFFFFULL), high = _mm512_set1_epi64(MULTIPLIER >> 32);
+		const __m512i cross = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(a, 32), low), _mm512_mul_epu32(a, high));
+		return _mm512_add_epi64(_mm512_mul_epu32(a, low), _mm512_slli_epi64(cross, 32));
+	}
+
+	// Advances the lanes, returns the outputs (XSH RR of the old states) in the low halves of 64-bit lanes
+	INLINE __m512i step() {
+		const __m512i state = _mm512_load_si512(mState);
+		_mm512_store_si512(mState, _mm512_add_epi64(multiply(state), _mm512_load_si512(mInc)));
+		const __m512i xorshifted = _mm512_and_si512(_mm512_srli_epi64(_mm512_xor_si512(_mm512_srli_epi64(state, 18), state), 27), _mm512_set1_epi64(0xFFFFFFFF));
+		const __m512i rot = _mm512_srli_epi64(state, 59);
+		const __m512i rotated = _mm512_or_si512(_mm512_srlv_epi64(xorshifted, rot), _mm512_sllv_epi64(xorshifted, _mm512_sub_epi64(_mm512_set1_epi64(32), rot)));
+		return _mm512_and_si512(rotated, _mm512_set1_epi64(0xFFFFFFFF));
+	}
+
+	INLINE void step(uint64_t* out) {
+		_mm512_store_si512(out, step());
+	}
+
+	// Exact conversion of values below 2^32: the bits are placed into the mantissa of 2^52
+	INLINE void nextDoubles(double* out) {
+		const __m512d shifted = _mm512_castsi512_pd(_mm512_or_si512(step(), _mm512_set1_epi64(0x4330000000000000LL)));
+		_mm512_storeu_pd(out, _mm512_mul_pd(_mm512_sub_pd(shifted, _mm512_set1_pd(4503599627370496.0)), _mm512_set1_pd(1.0 / 4294967296.0)));
+	}
+
+	// Values below 2^24 narrowed to 32 bits, their conversion is exact
+	INLINE void nextFloats(float* out) {
+		const __m256i bits = _mm512_cvtepi64_epi32(_mm512_srli_epi64(step(), 8));
+		_mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 16777216.0f)));
+	}
+#elif defined(__AVX2__)
+	static INLINE __m256i multiply(const __m256i a) {
+		const __m256i low = _mm256_set1_epi64x(MULTIPLIER & 0xFFFFFFFFULL), high = _mm256_set1_epi64x(MULTIPLIER >> 32);
+		const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), low), _mm256_mul_epu32(a, high));
+		return _mm256_add_epi64(_mm256_mul_epu32(a, low), _mm256_slli_epi64(cross, 32));
+	}
+
+	// Advances the four lanes starting at lane, returns the outputs in the low halves of 64-bit lanes
+	INLINE __m256i stepHalf(const uint32_t lane) {
+		const __m256i state = _mm256_load_si256(reinterpret_cast<const __m256i*>(mState + lane));
+		const __m256i inc = _mm256_load_si256(reinterpret_cast<const __m256i*>(mInc + lane));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(mState + lane), _mm256_add_epi64(multiply(state), inc));
+		const __m256i xorshifted = _mm256_and_si256(_mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(state, 18), state), 27), _mm256_set1_epi64x(0xFFFFFFFF));
+		const __m256i rot = _mm256_srli_epi64(state, 59);
+		const __m256i rotated = _mm256_or_si256(_mm256_srlv_epi64(xorshifted, rot), _mm256_sllv_epi64(xorshifted, _mm256_sub_epi64(_mm256_set1_epi64x(32), rot)));
+		return _mm256_and_si256(rotated, _mm256_set1_epi64x(0xFFFFFFFF));
+	}
+
+	INLINE void step(uint64_t* out) {
+		_mm256_store_si256(reinterpret_cast<__m256i*>(out), stepHalf(0));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(out + 4), stepHalf(4));
+	}
+
+	INLINE void nextDoubles(double* out) {
+		for (uint32_t lane = 0; lane < LANES; lane += 4) {
+			const __m256d shifted = _mm256_castsi256_pd(_mm256_or_si256(stepHalf(lane), _mm256_set1_epi64x(0x4330000000000000LL)));
+			_mm256_storeu_pd(out + lane, _mm256_mul_pd(_mm256_sub_pd(shifted, _mm256_set1_pd(4503599627370496.0)), _mm256_set1_pd(1.0 / 4294967296.0)));
+		}
+	}
+
+	// The low halves of the 64-bit lanes gathered into the low 128 bits
+	INLINE void nextFloats(float* out) {
+		const __m256i gather = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+		for (uint32_t lane = 0; lane < LANES; lane += 4) {
+			const __m128i bits = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_srli_epi64(stepHalf(lane), 8), gather));
+			_mm_storeu_ps(out + lane, _mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f / 16777216.0f)));
+		}
+	}
+#else
+	INLINE void step(uint64_t* out) {
+		for (uint32_t l = 0; l < LANES; ++l) {
+			const uint64_t oldstate = mState[l];
+			mState[l] = oldstate * MULTIPLIER + mInc[l];
+			const uint32_t xorshifted = uint32_t(((oldstate >> 18u) ^ oldstate) >> 27u);
+			const uint32_t rot = uint32_t(oldstate >> 59u);
+			out[l] = (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+	}
+
+	INLINE void nextDoubles(double* out) {
+		alignas(64) uint64_t outputs[LANES];
+		step(outputs);
+		for (uint32_t l = 0; l < LANES; ++l) {
+			out[l] = uint32_t(outputs[l]) * (1.0 / 4294967296.0);
+		}
+	}
+
+	INLINE void nextFloats(float* out) {
+		alignas(64) uint64_t outputs[LANES];
+		step(outputs);
+		for (uint32_t l = 0; l < LANES; ++l) {
+			out[l] = uniformFromBits<float>(uint32_t(outputs[l]));
+		}
+	}
+#endif
 };
\ No newline at end of file
@@ -1,104 +1,190 @@
 #pragma once
+#include "Parallel.h"
 #include <iostream>
 #include <vector>
 #include <array>
 #include <algorithm>
+#include <memory>
+#include <cassert>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
+// Samples a permutation with probability proportional to the product of functor(row, permutation[row]), the functor is
+// called size x size times per sample. mCache[S] is the sum of the products over the assignments of the rows
+// 0..|S|-1 to the columns of the subset S, filled bottom up one popcount layer after the other (a layer only reads the
+// previous one). The permutation is then read backwards from the full subset, the last row first
 class PermutationSampler {
 	bool mSkipPartialIdentity;
 	uint32_t mSize;
 	std::vector<Float> mCache;
+	std::vector<Float> mWeights; // [row * size + column], zero where the row may not go to the column
+	std::vector<uint32_t> mSubsets; // All subsets ordered by popcount
+	std::vector<uint32_t> mLayers; // Start of every popcount in mSubsets, size + 2 entries
 	std::vector<uint32_t> mPermut;
-	uint32_t mOpCount, mSampleOp;
-	Float mPositive;
+	std::unique_ptr<ThreadPool> mOwnPool; // Only with more than one thread, created by the first table that needs it
+	uint32_t mThreadCount;
+	ThreadPool* mLentPool;
+	bool mLent;
+	static constexpr uint32_t PARALLEL_CHUNK = 4096; // Subsets per task, smaller layers are filled by the calling thread
 public:
 
-	PermutationSampler(const uint32_t size, const bool skipPartialIdentity):mSkipPartialIdentity(skipPartialIdentity), mSize(size) {
-		mCache.resize(1i64 << size, -1.f);
+	// Zero thread count means all hardware threads, the results do not depend on it
+	PermutationSampler(const uint32_t size, const bool skipPartialIdentity, const uint32_t threadCount = 1):mSkipPartialIdentity(skipPartialIdentity), mSize(size),
+		mThreadCount(threadCount), mLentPool(nullptr), mLent(false) {
+		assert(size < 32); // The subsets are 32 bit masks, memory runs out well before that
+		mCache.resize(size_t(1) << size);
+		mWeights.resize(size * size);
 		mPermut.resize(size);
-		mPositive = Float(1);
+		mLayers.assign(size + 2, 0);
+		for (uint32_t s = 0; s < uint32_t(mCache.size()); ++s) {
+			++mLayers[popcount(s) + 1];
+		}
+		for (uint32_t k = 1; k < size + 2; ++k) {
+			mLayers[k] += mLayers[k - 1];
+		}
+		mSubsets.resize(mCache.size());
+		std::vector<uint32_t> next(mLayers.begin(), mLayers.end() - 1);
+		for (uint32_t s = 0; s < uint32_t(mCache.size()); ++s) {
+			mSubsets[next[popcount(s)]++] = s;
+		}
 	}
 
-	template <typename TFunctor>
-	const std::vector<uint32_t> & sample(const TFunctor& mFunctor, Float rnd, Float &count) {
-		for (uint32_t i = 0; i < mSize; ++i) {
-			mPermut[i] = i;
+	// As Algorithm::setPool, only a sampler created with more than one thread takes it
+	void setPool(ThreadPool* pool) {
+		if (mThreadCount != 1) {
+			mLentPool = pool;
+			mLent = true;
 		}
-		mOpCount = 0;
-		mSampleOp = 0;
-		count = countPermutation(mFunctor, 0, 0);
-		for (uint32_t i = 0; i < mSize; ++i) {
-			mPermut[i] = i;
+	}
+
+	void restorePool() {
+		mLentPool = nullptr;
+		mLent = false;
+	}
+
+	// False when every product underflows (or no permutation is allowed), there is nothing to sample from and the
+	// permutation is left as it was
+	template <typename TFunctor>
+	bool sample(const TFunctor& mFunctor, Float rnd, Float &count) {
+		count = countPermutations(mFunctor);
+		if (count > Float(0)) {
+			samplePermutation(rnd * count);
+			return true;
 		}
-		samplePermutation(mFunctor, rnd * count, 0, 0);
-		//std::cout << mOpCount << " " << mSampleOp << std::endl;
-		mPositive *= Float(-1);
+		return false;
+	}
+
+	// Of the last successful sample
+	INLINE const std::vector<uint32_t>& permutation() const {
 		return mPermut;
 	}
 
 	template <typename TFunctor>
 	Float normalization(const TFunctor& mFunctor) {
-		for (uint32_t i = 0; i < mSize; ++i) {
-			mPermut[i] = i;
-		}
-		mOpCount = 0;
-		Float result = countPermutation(mFunctor, 0, 0);
-		mPositive *= Float(-1);
-		return result;
+		return countPermutations(mFunctor);
 	}
 
 private:
+	// The own one or a lent one, nullptr fills the table on the calling thread
+	ThreadPool* pool() {
+		if (mLent) {
+			return mLentPool;
+		}
+		if (mThreadCount != 1 && !mOwnPool) {
+			mOwnPool.reset(new ThreadPool(mThreadCount));
+		}
+		return mOwnPool.get();
+	}
+
+	INLINE static uint32_t popcount(uint32_t x) {
+		uint32_t count = 0;
+		for (; x != 0; x &= x - 1) {
+			++count;
+		}
+		return count;
+	}
+
+	INLINE static uint32_t lowestBit(const uint32_t x) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, x);
+		return uint32_t(index);
+#else
+		return uint32_t(__builtin_ctz(x));
+#endif
+	}
+
+	// The row of a subset is its popcount - 1, so every set bit is a column that row can take
+	INLINE void fillSubset(const uint32_t subset, const Float* rowWeights) {
+		Float sum(0);
+		for (uint32_t bits = subset; bits != 0; bits &= bits - 1) {
+			const uint32_t column = lowestBit(bits);
+			sum += mCache[subset ^ (1u << column)] * rowWeights[column];
+		}
+		mCache[subset] = sum;
+	}
+
 	template <typename TFunctor>
-	void samplePermutation(const TFunctor& mFunctor, Float rnd, const uint32_t level, const uint32_t cache) {
-		for (uint32_t i = level; i < mSize; ++i) {
-			++mSampleOp;
-			std::swap(mPermut[i], mPermut[level]);
-			if (!mSkipPartialIdentity || level != mPermut[level]) {
-				const uint32_t newCache = cache | (1 << mPermut[level]);
-				const Float funcValue = mFunctor(level, mPermut[level]);
-				Float value = funcValue;
-				if (level + 1 < mSize - 1) {
-					value *= mCache[newCache] * mPositive;
-				}
-				else {
-					value *= (!mSkipPartialIdentity || (mSize - 1) != mPermut[mSize - 1]) ? mFunctor(mSize - 1, mPermut[mSize - 1]) : 0.f;
-				}
-				if (value < rnd && i + 1 < mSize) {
-					rnd -= value;
-				}
-				else {
-					if (level + 1 < mSize - 1) {
-						samplePermutation(mFunctor, rnd / funcValue, level + 1, newCache);
+	Float countPermutations(const TFunctor& mFunctor) {
+		for (uint32_t row = 0; row < mSize; ++row) {
+			for (uint32_t column = 0; column < mSize; ++column) {
+				mWeights[row * mSize + column] = (!mSkipPartialIdentity || row != column) ? mFunctor(row, column) : Float(0);
+			}
+		}
+		mCache[0] = Float(1);
+		for (uint32_t k = 1; k <= mSize; ++k) {
+			const uint32_t begin = mLayers[k], end = mLayers[k + 1];
+			const Float* rowWeights = &mWeights[(k - 1) * mSize];
+			ThreadPool* pool = end - begin > PARALLEL_CHUNK ? this->pool() : nullptr;
+			if (pool) {
+				pool->parallelFor((end - begin + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, [this, begin, end, rowWeights](const uint32_t chunk, const uint32_t) {
+					const uint32_t chunkEnd = std::min(end, begin + (chunk + 1) * PARALLEL_CHUNK);
+					for (uint32_t i = begin + chunk * PARALLEL_CHUNK; i < chunkEnd; ++i) {
+						fillSubset(mSubsets[i], rowWeights);
 					}
-					assert(mPermut[mSize - 1] != mSize - 1);
-					return;
+				});
+			}
+			else {
+				for (uint32_t i = begin; i < end; ++i) {
+					fillSubset(mSubsets[i], rowWeights);
 				}
 			}
-			std::swap(mPermut[i], mPermut[level]);
 		}
-		assert(false);
+		return mCache[mCache.size() - 1];
 	}
 
-	template <typename TFunctor>
-	Float countPermutation(const TFunctor& mFunctor, const uint32_t level, const uint32_t cache) {
-		if (level == mSize - 1) {
-			return (!mSkipPartialIdentity || level != mPermut[level]) ? mFunctor(level, mPermut[level]) : 0.f;
-		}
-		Float & result = mCache[cache];
-		if (result * mPositive < 0.f) {
-			result = 0.f;
-			for (uint32_t i = level; i < mSize; ++i) {
-				++mOpCount;
-				std::swap(mPermut[i], mPermut[level]);
-				if (!mSkipPartialIdentity || level != mPermut[level]) {
-					const uint32_t newCache = cache | (1 << mPermut[level]);
-					result += mFunctor(level, mPermut[level]) * countPermutation(mFunctor, level + 1, newCache);
+	// rnd is in [0, mCache[subset]), it is rescaled to the remaining subset after every row
+	void samplePermutation(Float rnd) {
+		uint32_t subset = uint32_t(mCache.size() - 1);
+		for (int row = int(mSize) - 1; row >= 0; --row) {
+			const Float* rowWeights = &mWeights[row * mSize];
+			uint32_t chosen = mSize;
+			for (uint32_t bits = subset; bits != 0; bits &= bits - 1) {
+				const uint32_t column = lowestBit(bits);
+				if (rowWeights[column] == Float(0)) {
+					continue;
+				}
+				const Float value = mCache[subset ^ (1u << column)] * rowWeights[column];
+				if (value == Float(0)) {
+					continue;
 				}
-				std::swap(mPermut[i], mPermut[level]);
+				chosen = column; // The last positive one takes what rounding leaves over
+				if (rnd < value) {
+					break;
+				}
+				rnd -= value;
 			}
-			result *= mPositive;
+			assert(chosen < mSize);
+			mPermut[row] = chosen;
+			rnd = std::min(rnd, mCache[subset ^ (1u << chosen)] * rowWeights[chosen]) / rowWeights[chosen];
+			subset ^= 1u << chosen;
+		}
+#ifndef NDEBUG
+		for (uint32_t row = 0; row < mSize; ++row) {
+			assert(!mSkipPartialIdentity || mPermut[row] != row);
 		}
-		return abs(result);
+#endif
 	}
 
 };
\ No newline at end of file
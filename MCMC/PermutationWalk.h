@@ -0,0 +1,53 @@
+#pragma once
+#include "Utils.h"
+#include <vector>
+#include <algorithm>
+
+// Metropolis walk over the permutations with the target of PermutationSampler (the product of factor(row, permutation[row])),
+// for ladders too large for its subset table. Every proposal exchanges the columns of two rows, alternately neighbours
+// (which are accepted most often on a temperature ladder) and a uniform pair, both symmetric. A sample costs O(proposals)
+// given the log factors, the walk is a valid MH kernel but its samples are correlated, unlike the exact ones
+class PermutationWalk {
+	uint32_t mSize;
+	std::vector<uint32_t> mPermut;
+	uint64_t mProposals, mAccepted;
+public:
+	PermutationWalk(const uint32_t size) : mSize(size), mProposals(0), mAccepted(0) {
+		mPermut.resize(size);
+	}
+
+	// Starts from the identity, logFunctor(row, column) is the log of the factor
+	template <typename TFunctor>
+	const std::vector<uint32_t>& sample(const TFunctor& logFunctor, Pcg& random, const uint32_t proposalCount) {
+		for (uint32_t i = 0; i < mSize; ++i) {
+			mPermut[i] = i;
+		}
+		if (mSize < 2) {
+			return mPermut;
+		}
+		for (uint32_t p = 0; p < proposalCount; ++p) {
+			uint32_t a, b;
+			if (p & 1) {
+				a = std::min(uint32_t(random() * mSize), mSize - 1);
+				b = std::min(uint32_t(random() * (mSize - 1)), mSize - 2);
+				b += b >= a ? 1 : 0;
+			}
+			else {
+				a = std::min(uint32_t(random() * (mSize - 1)), mSize - 2);
+				b = a + 1;
+			}
+			const Float logProposed = logFunctor(a, mPermut[b]) + logFunctor(b, mPermut[a]);
+			const Float logCurrent = logFunctor(a, mPermut[a]) + logFunctor(b, mPermut[b]);
+			++mProposals;
+			if (logProposed > LOG_ZERO && (logCurrent == LOG_ZERO || ratioFromLog(logProposed - logCurrent) > random())) {
+				++mAccepted;
+				std::swap(mPermut[a], mPermut[b]);
+			}
+		}
+		return mPermut;
+	}
+
+	INLINE Float acceptanceRate() const {
+		return mAccepted / Float(std::max(uint64_t(1), mProposals));
+	}
+};
\ No newline at end of file
@@ -2,38 +2,53 @@
 #include "Algorithm.h"
 #include "LocalMutation.h"
 #include "PermutationSampler.h"
+#include "PermutationWalk.h"
+#include <memory>
 
 enum class PermutationsType {
 	ALL = 0,
-	NON_IDENTITY = 1
+	NON_IDENTITY = 1,
+	METROPOLIS = 2 // Metropolis walk over the permutations instead of the exact subset table, polynomial in the chain count
 };
 
-template<uint32_t TDimension>
-class PermutationsAlgorithm : public Algorithm<TDimension> {
+template<uint32_t TDimension, typename TFloat = Float>
+class PermutationsAlgorithm : public Algorithm<TDimension, TFloat> {
+	using Signature = typename Integrand<TDimension, TFloat>::StateSignature;
 	struct Chain {
-		LocalMutation<TDimension>* mutator;
-		Float invTemperature;
+		LocalMutation<TDimension, TFloat>* mutator;
+		TFloat invTemperature;
 		Pcg random;
+		PcgLanes randomLanes; // Large steps
 		int swapAttempts, swaps;
+		Signature signature, proposedSignature; // Current state and the scratch space for proposals
 	};
 	std::vector<Chain> chains;
-	Float mLargeStepProb;
+	std::vector<TFloat> invTemperatures; // Of all chains, for the batched evaluation
+	TFloat mLargeStepProb;
 	PermutationsType mPermutationType;
-	PermutationSampler mPermutationSampler;
+	std::unique_ptr<PermutationSampler> mPermutationSampler; // Only for the exact types, its table has 2^(chain count) entries
+	PermutationWalk mPermutationWalk;
 public:
-	INLINE PermutationsAlgorithm(const Integrand<TDimension>& integrand, std::vector<Float> temperatures, const PermutationsType permutationType) : 
-		Algorithm<TDimension>(integrand), mPermutationType(permutationType), mPermutationSampler(uint32_t(temperatures.size()), permutationType == PermutationsType::NON_IDENTITY) {
+	// The thread count is for the subset table of the permutation sampler (zero means all hardware threads, see setPool for
+	// the test suite), the results do not depend on it
+	INLINE PermutationsAlgorithm(const Integrand<TDimension, TFloat>& integrand, std::vector<Float> temperatures, const PermutationsType permutationType,
+		const uint32_t threadCount = 1) : Algorithm<TDimension, TFloat>(integrand), mPermutationType(permutationType), mPermutationWalk(uint32_t(temperatures.size())) {
+		this->checkChainCount(temperatures.size());
+		if (permutationType != PermutationsType::METROPOLIS) {
+			mPermutationSampler.reset(new PermutationSampler(uint32_t(temperatures.size()), permutationType == PermutationsType::NON_IDENTITY, threadCount));
+		}
 		mLargeStepProb = 0.3f;
 		std::sort(temperatures.begin(), temperatures.end());
 		assert(temperatures.size() > 0 && temperatures[0] == 1.f);
 		chains.resize(temperatures.size());
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			chains[i].invTemperature = 1.f / temperatures[i];
-			chains[i].random.reset(1337 * i + 235, 1579 * i + 454);
-			chains[i].mutator = new LocalMutation<TDimension>(chains[i].random);
+			invTemperatures.push_back(chains[i].invTemperature);
+			chains[i].mutator = new LocalMutation<TDimension, TFloat>(chains[i].random);
 			chains[i].swapAttempts = 0;
 			chains[i].swaps = 0;
 		}
+		seed(Pcg(0xDEAD));
 	}
 
 	virtual ~PermutationsAlgorithm() override {
@@ -42,27 +57,36 @@ public:
 		}
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			do {
-				chains[i].mutator->setState(randomVector<TDimension>(chains[i].random));
-			} while (value(chains[i].mutator->getState(), i) == Float(0));
+				const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(chains[i].random);
+				chains[i].mutator->setState(state, logValue(state, i));
+			} while (exp(chains[i].mutator->getLogValue()) == TFloat(0)); // Start where the value does not underflow
 			chains[i].mutator->startAdaptation(0.3f);
+			this->mIntegrand.signature(chains[i].mutator->getState(), chains[i].signature);
 		}
-		std::vector<Vector<TDimension>> currentStatesBackup(chains.size());
+		std::vector<Vector<TDimension, TFloat>> currentStatesBackup(chains.size());
+		std::vector<Signature> signaturesBackup(chains.size());
+		std::vector<TFloat> logValues(chains.size() * chains.size()), stateLogValues;
+		// The sampler sums the permutations in the default precision, its weights are exponentiated in it too, so that a
+		// float log value underflows no earlier than the products do
 		std::vector<Float> values(chains.size() * chains.size()), permutedValues(chains.size() * chains.size());
 		for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
 			for (int c = int(chains.size()) - 1; c >= 0; --c) {
 				const bool localStep = i % 3 != 0;
-				Vector<TDimension> proposed;
+				Vector<TDimension, TFloat> proposed;
 				if (localStep) {
 					proposed = chains[c].mutator->mutateState();
 				}
 				else {
-					proposed = randomVector<TDimension>(chains[c].random);
+					proposed = randomVector<TDimension, TFloat>(chains[c].randomLanes);
 				}
-				if (acceptRatio(chains[c].mutator->getState(), proposed, c) > chains[c].random()) {
-					chains[c].mutator->mutationWasAccepted(proposed, localStep);
+				this->mIntegrand.signature(proposed, chains[c].proposedSignature);
+				const TFloat logProposed = logValue(chains[c].proposedSignature, c);
+				if (acceptRatio(c, logProposed) > chains[c].random()) {
+					chains[c].mutator->mutationWasAccepted(proposed, logProposed, localStep);
+					std::swap(chains[c].signature, chains[c].proposedSignature);
 				}
 				else {
 					chains[c].mutator->mutationWasRejected(localStep);
@@ -70,28 +94,44 @@ public:
 				if (c == 0 && i >= MCMC_BURN_PERIOD) {
 					const uint32_t index = i - MCMC_BURN_PERIOD;
 					samples[index].sample = chains[c].mutator->getState();
-					samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
+					samples[index].pdf = exp(chains[c].mutator->getLogValue()); // The first chain has temperature one
 				}
 			}
+			for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
+				this->mIntegrand.logValueAllTemperatures(chains[c2].signature, invTemperatures, stateLogValues);
+				for (int c1 = int(chains.size()) - 1; c1 >= 0; --c1) {
+					logValues[c1 * chains.size() + c2] = stateLogValues[c1];
+				}
+			}
+			for (auto& chain : chains) {
+				++chain.swapAttempts;
+			}
+			if (mPermutationType == PermutationsType::METROPOLIS) {
+				// Every chain gets about two proposals per step, which keeps the step linear in the chain count besides the evaluations
+				const std::vector<uint32_t>& proposal = mPermutationWalk.sample([&logValues, this](uint32_t chainBefore, uint32_t chainAfter) {
+					return Float(logValues[chainBefore * chains.size() + chainAfter]);
+				}, this->mRandom, 2 * uint32_t(chains.size()));
+				swapStates(proposal, logValues, currentStatesBackup, signaturesBackup);
+				continue;
+			}
 			for (int c1 = int(chains.size()) - 1; c1 >= 0; --c1) {
-				Float average = 0;
+				// Every permutation takes exactly one value from each row, so scaling a row by its maximum does not change the distribution
+				TFloat maxLog = LOG_ZERO;
 				for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-					values[c1 * chains.size() + c2] = value(chains[c2].mutator->getState(), c1);
-					average += values[c1 * chains.size() + c2];
+					maxLog = std::max(maxLog, logValues[c1 * chains.size() + c2]);
 				}
-				average /= chains.size();
 				for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-					values[c1 * chains.size() + c2] /= average;
+					values[c1 * chains.size() + c2] = exp(Float(logValues[c1 * chains.size() + c2]) - Float(maxLog));
 				}
 			}
 			// DO PERMUTATION SWAP!
-			for (auto& chain : chains) {
-				++chain.swapAttempts;
-			}
 			Float nominator;
-			const std::vector<uint32_t> proposal = mPermutationSampler.sample([&values, this](uint32_t chainBefore, uint32_t chainAfter) {
+			if (!mPermutationSampler->sample([&values, this](uint32_t chainBefore, uint32_t chainAfter) {
 				return values[chainBefore * chains.size() + chainAfter];
-			}, this->mRandom(), nominator);
+			}, this->mRandom(), nominator)) {
+				continue; // No permutation has a representable weight, the chains stay where they are
+			}
+			const std::vector<uint32_t> proposal = mPermutationSampler->permutation();
 			bool accepted = mPermutationType == PermutationsType::ALL; // Automatically accept
 			if (mPermutationType == PermutationsType::NON_IDENTITY) {
 				// Permute the values
@@ -101,7 +141,7 @@ public:
 						permutedValues[c1 * chains.size() + proposal[c2]] = values[c1 * chains.size() + c2];
 					}
 				}
-				const Float denominator = mPermutationSampler.normalization([&permutedValues, this](uint32_t chainBefore, uint32_t chainAfter) {
+				const Float denominator = mPermutationSampler->normalization([&permutedValues, this](uint32_t chainBefore, uint32_t chainAfter) {
 					return permutedValues[chainBefore * chains.size() + chainAfter];
 				});
 				if (nominator / denominator >= this->mRandom()) {
@@ -109,16 +149,7 @@ public:
 				}
 			}
 			if (accepted) {
-				// Actually swap the states
-				for (int c = int(chains.size()) - 1; c >= 0; --c) {
-					currentStatesBackup[c] = chains[c].mutator->getState();
-					if (c != proposal[c]) {
-						++chains[c].swaps;
-					}
-				}
-				for (int c = int(chains.size()) - 1; c >= 0; --c) {
-					chains[c].mutator->setState(currentStatesBackup[proposal[c]]);
-				}
+				swapStates(proposal, logValues, currentStatesBackup, signaturesBackup);
 			}
 		}
 	}
@@ -134,6 +165,9 @@ public:
 		if (mPermutationType == PermutationsType::NON_IDENTITY) {
 			return "Permutations - SHUFFLE";
 		}
+		if (mPermutationType == PermutationsType::METROPOLIS) {
+			return "Permutations - METROPOLIS";
+		}
 		assert(false);
 		return "Unknown";
 	}
@@ -142,18 +176,74 @@ public:
 
 	virtual void printStats() const override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
-			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << Float(100) * chains[i].mutator->acceptanceRate()
-				<< " % Swap rate: " << Float(100) * (chains[i].swaps / Float(chains[i].swapAttempts)) << " %" << std::endl;
+			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << TFloat(100) * chains[i].mutator->acceptanceRate()
+				<< " % Swap rate: " << TFloat(100) * (chains[i].swaps / TFloat(chains[i].swapAttempts)) << " %" << std::endl;
+		}
+		if (mPermutationType == PermutationsType::METROPOLIS) {
+			std::cout << "Permutation walk acceptance rate: " << Float(100) * mPermutationWalk.acceptanceRate() << " %" << std::endl;
+		}
+	}
+
+	virtual void seed(const Pcg& stream) override {
+		Algorithm<TDimension, TFloat>::seed(stream);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			const Pcg chain = this->chainStream(stream, i);
+			chains[i].random = chain.stream(0, PCG_GENERATOR_STREAM);
+			chains[i].randomLanes.reset(chain, 1, PCG_GENERATOR_STREAM);
+		}
+	}
+
+	// The pool is the one of the permutation sampler
+	virtual void setPool(ThreadPool* pool) override {
+		if (mPermutationSampler) {
+			mPermutationSampler->setPool(pool);
+		}
+	}
+
+	virtual void restorePool() override {
+		if (mPermutationSampler) {
+			mPermutationSampler->restorePool();
+		}
+	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		const PermutationsAlgorithm& algorithm = static_cast<const PermutationsAlgorithm&>(other);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			chains[i].mutator->mergeStats(*algorithm.chains[i].mutator);
+			chains[i].swapAttempts += algorithm.chains[i].swapAttempts;
+			chains[i].swaps += algorithm.chains[i].swaps;
 		}
 	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed, const uint32_t chainNo) const {
-		const Float valCurr = this->mIntegrand.value(current, chains[chainNo].invTemperature);
-		const Float valProp = this->mIntegrand.value(proposed, chains[chainNo].invTemperature);
-		return valCurr > Float(0) ? std::min(Float(1), valProp / valCurr) : Float(1);
+	// Chain c takes the state of chain proposal[c]
+	INLINE void swapStates(const std::vector<uint32_t>& proposal, const std::vector<TFloat>& logValues, std::vector<Vector<TDimension, TFloat>>& currentStatesBackup,
+		std::vector<Signature>& signaturesBackup) {
+		for (int c = int(chains.size()) - 1; c >= 0; --c) {
+			currentStatesBackup[c] = chains[c].mutator->getState();
+			if (c != proposal[c]) {
+				++chains[c].swaps;
+			}
+		}
+		for (int c = int(chains.size()) - 1; c >= 0; --c) {
+			std::swap(signaturesBackup[c], chains[c].signature);
+		}
+		for (int c = int(chains.size()) - 1; c >= 0; --c) {
+			chains[c].mutator->setState(currentStatesBackup[proposal[c]], logValues[c * chains.size() + proposal[c]]);
+			// Every backup is taken exactly once, so the signatures can be moved without copying
+			std::swap(chains[c].signature, signaturesBackup[proposal[c]]);
+		}
+	}
+
+	INLINE TFloat acceptRatio(const uint32_t chainNo, const TFloat logProposed) const {
+		const TFloat logCurr = chains[chainNo].mutator->getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
+	}
+
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& state, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(state, chains[chainNo].invTemperature);
 	}
 
-	INLINE Float value(const Vector<TDimension>& state, const uint32_t chainNo) const {
-		return this->mIntegrand.value(state, chains[chainNo].invTemperature);
+	INLINE TFloat logValue(const Signature& signature, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(signature, chains[chainNo].invTemperature);
 	}
 };
@@ -0,0 +1,119 @@
+#pragma once
+#include "Config.h"
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+// KLL streaming quantile sketch: level h holds values of weight 2^h, a full level is sorted and every other value (from
+// a random offset) moves up. The level capacities shrink by 2/3 from the top, so at most about 3 k values are kept
+// whatever the stream length, and a quantile is off by roughly 1 / k in rank. The offsets come from an internal
+// generator so the sketch never touches the caller's random streams
+template<typename TFloat = Float>
+class QuantileSketch {
+	static constexpr uint32_t RANDOM_SEED = 0x2545F491u;
+	std::vector<std::vector<TFloat>> mLevels;
+	uint32_t mK;
+	uint64_t mCount;
+	uint32_t mRandomState;
+	std::vector<std::pair<TFloat, uint64_t>> mWeighted; // Scratch for the queries
+public:
+	QuantileSketch(const uint32_t k = 200) : mK(std::max(k, 8u)), mCount(0), mRandomState(RANDOM_SEED) {
+		mLevels.resize(1);
+	}
+
+	INLINE uint64_t count() const {
+		return mCount;
+	}
+
+	// The offsets start over too, so the same stream is sketched the same way
+	void clear() {
+		mLevels.assign(1, std::vector<TFloat>());
+		mCount = 0;
+		mRandomState = RANDOM_SEED;
+	}
+
+	// Allocated, including the query scratch
+	size_t bytes() const {
+		size_t result = mWeighted.capacity() * sizeof(std::pair<TFloat, uint64_t>);
+		for (const std::vector<TFloat>& level : mLevels) {
+			result += level.capacity() * sizeof(TFloat);
+		}
+		return result;
+	}
+
+	void add(const TFloat value) {
+		mLevels[0].push_back(value);
+		++mCount;
+		for (uint32_t h = 0; h < uint32_t(mLevels.size()); ++h) {
+			if (mLevels[h].size() >= capacity(h)) {
+				compact(h);
+				break;
+			}
+		}
+	}
+
+	// The values at ranks (i + 1) / (quantiles.size() + 1) of the stream, ascending
+	void quantiles(std::vector<TFloat>& quantiles) {
+		if (mCount == 0) {
+			return;
+		}
+		mWeighted.clear();
+		for (uint32_t h = 0; h < uint32_t(mLevels.size()); ++h) {
+			for (const TFloat v : mLevels[h]) {
+				mWeighted.emplace_back(v, uint64_t(1) << h);
+			}
+		}
+		std::sort(mWeighted.begin(), mWeighted.end());
+		uint64_t total = 0;
+		for (const std::pair<TFloat, uint64_t>& w : mWeighted) {
+			total += w.second;
+		}
+		uint64_t cumulative = 0;
+		size_t index = 0;
+		for (size_t i = 0; i < quantiles.size(); ++i) {
+			const uint64_t rank = total * (i + 1) / (quantiles.size() + 1);
+			while (index + 1 < mWeighted.size() && cumulative + mWeighted[index].second <= rank) {
+				cumulative += mWeighted[index].second;
+				++index;
+			}
+			quantiles[i] = mWeighted[index].first;
+		}
+	}
+
+private:
+	// k at the top level, two thirds of the level above below it, at least 2
+	INLINE size_t capacity(const uint32_t h) const {
+		TFloat c = TFloat(mK);
+		for (uint32_t i = h + 1; i < uint32_t(mLevels.size()); ++i) {
+			c *= TFloat(2) / TFloat(3);
+		}
+		return std::max(size_t(2), size_t(c));
+	}
+
+	// Halves level h into level h + 1, an odd value out stays
+	void compact(const uint32_t h) {
+		if (h + 1 == mLevels.size()) {
+			mLevels.emplace_back();
+		}
+		std::vector<TFloat>& level = mLevels[h];
+		std::sort(level.begin(), level.end());
+		mRandomState ^= mRandomState << 13;
+		mRandomState ^= mRandomState >> 17;
+		mRandomState ^= mRandomState << 5;
+		const size_t even = level.size() & ~size_t(1);
+		for (size_t i = (mRandomState >> 16) & 1; i < even; i += 2) {
+			mLevels[h + 1].push_back(level[i]);
+		}
+		if (even < level.size()) {
+			level[0] = level[even];
+			level.resize(1);
+		}
+		else {
+			level.clear();
+		}
+		if (mLevels[h + 1].size() >= capacity(h + 1)) {
+			compact(h + 1);
+		}
+	}
+};
\ No newline at end of file
@@ -1,15 +1,15 @@
 #pragma once
 #include "Algorithm.h"
 
-template<uint32_t TDimension>
-class ReferenceAlgorithm : public Algorithm<TDimension> {
+template<uint32_t TDimension, typename TFloat = Float>
+class ReferenceAlgorithm : public Algorithm<TDimension, TFloat> {
 public:
-	INLINE ReferenceAlgorithm(const Integrand<TDimension>& integrand) : Algorithm<TDimension>(integrand) {}
+	INLINE ReferenceAlgorithm(const Integrand<TDimension, TFloat>& integrand) : Algorithm<TDimension, TFloat>(integrand) {}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		const auto& dist = this->mIntegrand.getDistribution();
 		for (uint32_t i = 0; i < uint32_t(samples.size()); ++i) {
-			samples[i].sample = dist.sample(randomVector<TDimension>(this->mRandom));
+			samples[i].sample = dist.sample(randomVector<TDimension, TFloat>(this->mRandom));
 			samples[i].pdf = dist.pdf(samples[i].sample);
 		}
 	}
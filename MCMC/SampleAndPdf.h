@@ -1,8 +1,8 @@
 #pragma once
 #include "Vector.h"
 
-template<uint32_t TDimension>
+template<uint32_t TDimension, typename TFloat = Float>
 struct SampleAndPdf {
-	Vector<TDimension> sample;
-	Float pdf;
+	Vector<TDimension, TFloat> sample;
+	TFloat pdf;
 };
\ No newline at end of file
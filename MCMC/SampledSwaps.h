@@ -2,30 +2,37 @@
 #include "Algorithm.h"
 #include "LocalMutation.h"
 
-template<uint32_t TDimension>
-class SampledSwapsAlgorithm : public Algorithm<TDimension> {
+template<uint32_t TDimension, typename TFloat = Float>
+class SampledSwapsAlgorithm : public Algorithm<TDimension, TFloat> {
+	using Signature = typename Integrand<TDimension, TFloat>::StateSignature;
 	struct Chain {
-		LocalMutation<TDimension>* mutator;
-		Float invTemperature;
+		LocalMutation<TDimension, TFloat>* mutator;
+		TFloat invTemperature;
 		Pcg random;
+		PcgLanes randomLanes; // Large steps
 		int swapAttempts, swaps, realSwaps;
+		Signature signature, proposedSignature; // Current state and the scratch space for proposals
+		std::vector<TFloat> logValues; // Of the current state at the temperatures of all chains, moves with the state on swaps
 	};
 	std::vector<Chain> chains;
-	Float mLargeStepProb;
+	std::vector<TFloat> invTemperatures; // Of all chains, for the batched evaluation
+	TFloat mLargeStepProb;
 public:
-	INLINE SampledSwapsAlgorithm(const Integrand<TDimension>& integrand, std::vector<Float> temperatures) : Algorithm<TDimension>(integrand) {
+	INLINE SampledSwapsAlgorithm(const Integrand<TDimension, TFloat>& integrand, std::vector<Float> temperatures) : Algorithm<TDimension, TFloat>(integrand) {
+		this->checkChainCount(temperatures.size());
 		mLargeStepProb = 0.3f;
 		std::sort(temperatures.begin(), temperatures.end());
 		assert(temperatures.size() > 0 && temperatures[0] == 1.f);
 		chains.resize(temperatures.size());
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			chains[i].invTemperature = 1.f / temperatures[i];
-			chains[i].random.reset(1337 * i + 235, 1579 * i + 454);
-			chains[i].mutator = new LocalMutation<TDimension>(chains[i].random);
+			invTemperatures.push_back(chains[i].invTemperature);
+			chains[i].mutator = new LocalMutation<TDimension, TFloat>(chains[i].random);
 			chains[i].swapAttempts = 0;
 			chains[i].swaps = 0;
 			chains[i].realSwaps = 0;
 		}
+		seed(Pcg(0xDEAD));
 	}
 
 	virtual ~SampledSwapsAlgorithm() override {
@@ -34,26 +41,35 @@ public:
 		}
 	}
 
-	virtual void run(std::vector<SampleAndPdf<TDimension>>& samples) override {
+	virtual void run(std::vector<SampleAndPdf<TDimension, TFloat>>& samples) override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
 			do {
-				chains[i].mutator->setState(randomVector<TDimension>(chains[i].random));
-			} while (value(chains[i].mutator->getState(), i) == Float(0));
+				const Vector<TDimension, TFloat> state = randomVector<TDimension, TFloat>(chains[i].random);
+				chains[i].mutator->setState(state, logValue(state, i));
+			} while (exp(chains[i].mutator->getLogValue()) == TFloat(0)); // Start where the value does not underflow
 			chains[i].mutator->startAdaptation(0.3f);
+			this->mIntegrand.signature(chains[i].mutator->getState(), chains[i].signature);
+			this->mIntegrand.logValueAllTemperatures(chains[i].signature, invTemperatures, chains[i].logValues);
 		}
-		std::vector<Float> probabilities(chains.size());
+		// The log values are a chain x temperature matrix, only the row of a chain whose state moved is evaluated again, so
+		// the swap weights of a chain cost O(chains) lookups instead of O(chains) evaluations
+		std::vector<TFloat> probabilities(chains.size()), logWeights(chains.size());
 		for (uint32_t i = 0; i < uint32_t(samples.size()) + MCMC_BURN_PERIOD; ++i) {
 			for (int c = int(chains.size()) - 1; c >= 0; --c) {
 				const bool localStep = i % 3 != 0;
-				Vector<TDimension> proposed;
+				Vector<TDimension, TFloat> proposed;
 				if (localStep) {
 					proposed = chains[c].mutator->mutateState();
 				}
 				else {
-					proposed = randomVector<TDimension>(chains[c].random);
+					proposed = randomVector<TDimension, TFloat>(chains[c].randomLanes);
 				}
-				if (acceptRatio(chains[c].mutator->getState(), proposed, c) > chains[c].random()) {
-					chains[c].mutator->mutationWasAccepted(proposed, localStep);
+				this->mIntegrand.signature(proposed, chains[c].proposedSignature);
+				const TFloat logProposed = logValue(chains[c].proposedSignature, c);
+				if (acceptRatio(c, logProposed) > chains[c].random()) {
+					chains[c].mutator->mutationWasAccepted(proposed, logProposed, localStep);
+					std::swap(chains[c].signature, chains[c].proposedSignature);
+					this->mIntegrand.logValueAllTemperatures(chains[c].signature, invTemperatures, chains[c].logValues);
 				}
 				else {
 					chains[c].mutator->mutationWasRejected(localStep);
@@ -61,46 +77,48 @@ public:
 				if (c == 0 && i >= MCMC_BURN_PERIOD) {
 					const uint32_t index = i - MCMC_BURN_PERIOD;
 					samples[index].sample = chains[c].mutator->getState();
-					samples[index].pdf = this->mIntegrand.value(samples[index].sample, Float(1));
+					samples[index].pdf = exp(chains[c].mutator->getLogValue()); // The first chain has temperature one
 				}
 				++chains[c].swapAttempts;
-				Float sum = 0;
+				// The products are summed relative to the largest one, so they do not underflow
+				TFloat maxLog = LOG_ZERO;
 				for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-					/*if (c2 == c)
-						continue;*/
-					probabilities[c2] = sum + value(chains[c].mutator->getState(), c2) * value(chains[c2].mutator->getState(), c);
-					sum = probabilities[c2];
+					logWeights[c2] = chains[c].logValues[c2] + chains[c2].logValues[c];
+					maxLog = std::max(maxLog, logWeights[c2]);
 				}
-				Float rnd = chains[c].random() * sum;
-				int selectedChain = int(chains.size()) - 1;
+				// Prefix sums from the last chain, they grow towards the first one
+				TFloat sum = 0;
 				for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-					/*if (c2 == c)
-						continue;*/
-					if (probabilities[c2] > rnd) {
-						selectedChain = c2;
-						break;
-					}
+					probabilities[c2] = sum + exp(logWeights[c2] - maxLog);
+					sum = probabilities[c2];
 				}
+				const TFloat rnd = chains[c].random() * sum;
+				// The last chain whose prefix sum exceeds rnd, the last one of all if rounding leaves none
+				const int firstBelow = int(std::partition_point(probabilities.begin(), probabilities.end(), [rnd](const TFloat p) { return p > rnd; }) - probabilities.begin());
+				const int selectedChain = firstBelow > 0 ? firstBelow - 1 : int(chains.size()) - 1;
 				if (selectedChain != c) {
-					Float sum2 = 0;
+					// Weights of the reverse move: chain c holds the selected state, the selected chain holds the state of c
+					const std::vector<TFloat>& selectedLogValues = chains[selectedChain].logValues;
+					TFloat maxLog2 = LOG_ZERO;
 					for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
-						/*if (c2 == c)
-							continue;*/
 						if (c2 == c) {
-							sum2 += value(chains[selectedChain].mutator->getState(), c2) * value(chains[selectedChain].mutator->getState(), c);
+							logWeights[c2] = selectedLogValues[c2] + selectedLogValues[c];
 						}
 						else if (c2 == selectedChain) {
-							sum2 += value(chains[selectedChain].mutator->getState(), c2) * value(chains[c].mutator->getState(), c);
+							logWeights[c2] = selectedLogValues[c2] + chains[c].logValues[c];
 						}
 						else {
-							sum2 += value(chains[selectedChain].mutator->getState(), c2) * value(chains[c2].mutator->getState(), c);
+							logWeights[c2] = selectedLogValues[c2] + chains[c2].logValues[c];
 						}
+						maxLog2 = std::max(maxLog2, logWeights[c2]);
+					}
+					TFloat sum2 = 0;
+					for (int c2 = int(chains.size()) - 1; c2 >= 0; --c2) {
+						sum2 += exp(logWeights[c2] - maxLog2);
 					}
-					if ((sum / sum2) > chains[c].random()) {
+					if ((sum / sum2) * exp(maxLog - maxLog2) > chains[c].random()) {
 						++chains[c].swaps;
-						auto temp = chains[c].mutator->getState();
-						chains[c].mutator->setState(chains[selectedChain].mutator->getState());
-						chains[selectedChain].mutator->setState(temp);
+						swapStates(c, selectedChain, chains[c].logValues[selectedChain], selectedLogValues[c]);
 					}
 				}
 			}
@@ -119,30 +137,47 @@ public:
 
 	virtual void printStats() const override {
 		for (uint32_t i = 0; i < chains.size(); ++i) {
-			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << Float(100) * chains[i].mutator->acceptanceRate()
-				<< " % Swap rate: " << Float(100) * (chains[i].swaps / Float(chains[i].swapAttempts)) << " %" << std::endl;
+			std::cout << "#" << (i + 1) << "[ " << (1.f / chains[i].invTemperature) << " ] Acceptance rate: " << TFloat(100) * chains[i].mutator->acceptanceRate()
+				<< " % Swap rate: " << TFloat(100) * (chains[i].swaps / TFloat(chains[i].swapAttempts)) << " %" << std::endl;
+		}
+	}
+
+	virtual void seed(const Pcg& stream) override {
+		Algorithm<TDimension, TFloat>::seed(stream);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			const Pcg chain = this->chainStream(stream, i);
+			chains[i].random = chain.stream(0, PCG_GENERATOR_STREAM);
+			chains[i].randomLanes.reset(chain, 1, PCG_GENERATOR_STREAM);
+		}
+	}
+
+	virtual void mergeStats(const Algorithm<TDimension, TFloat>& other) override {
+		const SampledSwapsAlgorithm& algorithm = static_cast<const SampledSwapsAlgorithm&>(other);
+		for (uint32_t i = 0; i < chains.size(); ++i) {
+			chains[i].mutator->mergeStats(*algorithm.chains[i].mutator);
+			chains[i].swapAttempts += algorithm.chains[i].swapAttempts;
+			chains[i].swaps += algorithm.chains[i].swaps;
 		}
 	}
 private:
-	INLINE Float acceptRatio(const Vector<TDimension>& current, const Vector<TDimension>& proposed, const uint32_t chainNo) const {
-		const Float valCurr = this->mIntegrand.value(current, chains[chainNo].invTemperature);
-		const Float valProp = this->mIntegrand.value(proposed, chains[chainNo].invTemperature);
-		return valCurr > Float(0) ? std::min(Float(1), valProp / valCurr) : Float(1);
+	INLINE TFloat acceptRatio(const uint32_t chainNo, const TFloat logProposed) const {
+		const TFloat logCurr = chains[chainNo].mutator->getLogValue();
+		return logCurr > LOG_ZERO ? ratioFromLog(logProposed - logCurr) : TFloat(1);
+	}
+
+	INLINE void swapStates(const uint32_t chain1, const uint32_t chain2, const TFloat log1_t2, const TFloat log2_t1) {
+		const Vector<TDimension, TFloat> temp = chains[chain1].mutator->getState();
+		chains[chain1].mutator->setState(chains[chain2].mutator->getState(), log2_t1);
+		chains[chain2].mutator->setState(temp, log1_t2);
+		std::swap(chains[chain1].signature, chains[chain2].signature);
+		std::swap(chains[chain1].logValues, chains[chain2].logValues);
 	}
 
-	INLINE Float swapRatio(const uint32_t chain1, const uint32_t chain2) const {
-		const auto state1 = chains[chain1].mutator->getState();
-		const auto state2 = chains[chain2].mutator->getState();
-		const Float val1_t1 = this->mIntegrand.value(state1, chains[chain1].invTemperature);
-		const Float val1_t2 = this->mIntegrand.value(state1, chains[chain2].invTemperature);
-		const Float val2_t1 = this->mIntegrand.value(state2, chains[chain1].invTemperature);
-		const Float val2_t2 = this->mIntegrand.value(state2, chains[chain2].invTemperature);
-		const Float factor1 = val1_t2 / val1_t1;
-		const Float factor2 = val2_t1 / val2_t2;
-		return std::min(Float(1), factor1 * factor2);
+	INLINE TFloat logValue(const Vector<TDimension, TFloat>& state, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(state, chains[chainNo].invTemperature);
 	}
 
-	INLINE Float value(const Vector<TDimension>& state, const uint32_t chainNo) const {
-		return this->mIntegrand.value(state, chains[chainNo].invTemperature);
+	INLINE TFloat logValue(const Signature& signature, const uint32_t chainNo) const {
+		return this->mIntegrand.logValue(signature, chains[chainNo].invTemperature);
 	}
 }; 
@@ -0,0 +1,324 @@
+#pragma once
+#include "Config.h"
+#include <new>
+#include <vector>
+#include <cstddef>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Allocator for the packed arrays, so every SimdDouble and SimdFloat load is aligned
+template<typename T, size_t TAlignment = 64>
+class AlignedAllocator {
+public:
+	using value_type = T;
+	template<typename U> struct rebind { using other = AlignedAllocator<U, TAlignment>; };
+
+	INLINE AlignedAllocator() = default;
+	template<typename U>
+	INLINE AlignedAllocator(const AlignedAllocator<U, TAlignment>&) {}
+
+	INLINE T* allocate(const size_t n) {
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(TAlignment)));
+	}
+
+	INLINE void deallocate(T* p, const size_t) {
+		::operator delete(p, std::align_val_t(TAlignment));
+	}
+
+	template<typename U>
+	INLINE bool operator==(const AlignedAllocator<U, TAlignment>&) const { return true; }
+	template<typename U>
+	INLINE bool operator!=(const AlignedAllocator<U, TAlignment>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Pack of doubles, 8 lanes with AVX-512, 4 lanes with AVX2 and a single lane otherwise
+#if defined(__AVX512F__)
+class SimdDouble {
+	__m512d mData;
+public:
+	static constexpr uint32_t WIDTH = 8;
+
+	INLINE SimdDouble() = default;
+	INLINE SimdDouble(const __m512d data) : mData(data) {}
+	INLINE SimdDouble(const double x) : mData(_mm512_set1_pd(x)) {}
+
+	INLINE static SimdDouble load(const double* p) { return _mm512_load_pd(p); }
+	INLINE static SimdDouble loadUnaligned(const double* p) { return _mm512_loadu_pd(p); }
+	INLINE void store(double* p) const { _mm512_store_pd(p, mData); }
+	INLINE void storeUnaligned(double* p) const { _mm512_storeu_pd(p, mData); }
+
+	INLINE SimdDouble operator+(const SimdDouble v) const { return _mm512_add_pd(mData, v.mData); }
+	INLINE SimdDouble operator-(const SimdDouble v) const { return _mm512_sub_pd(mData, v.mData); }
+	INLINE SimdDouble operator*(const SimdDouble v) const { return _mm512_mul_pd(mData, v.mData); }
+
+	// a * b + c
+	INLINE friend SimdDouble fma(const SimdDouble a, const SimdDouble b, const SimdDouble c) { return _mm512_fmadd_pd(a.mData, b.mData, c.mData); }
+	INLINE friend SimdDouble max(const SimdDouble a, const SimdDouble b) { return _mm512_max_pd(a.mData, b.mData); }
+	INLINE friend SimdDouble min(const SimdDouble a, const SimdDouble b) { return _mm512_min_pd(a.mData, b.mData); }
+	INLINE friend SimdDouble round(const SimdDouble a) { return _mm512_roundscale_pd(a.mData, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	// Zero in the lanes where a < limit
+	INLINE friend SimdDouble zeroBelow(const SimdDouble a, const SimdDouble limit, const SimdDouble value) {
+		return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a.mData, limit.mData, _CMP_GE_OQ), value.mData);
+	}
+	// 2^n for integral n in [-1022, 1023]
+	INLINE friend SimdDouble pow2(const SimdDouble n) {
+		const __m512d biased = _mm512_add_pd(n.mData, _mm512_set1_pd(4503599627371519.0)); // 2^52 + 1023
+		return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(biased), 52));
+	}
+
+	INLINE double horizontalSum() const { return _mm512_reduce_add_pd(mData); }
+	INLINE double horizontalMax() const { return _mm512_reduce_max_pd(mData); }
+};
+#elif defined(__AVX2__)
+class SimdDouble {
+	__m256d mData;
+public:
+	static constexpr uint32_t WIDTH = 4;
+
+	INLINE SimdDouble() = default;
+	INLINE SimdDouble(const __m256d data) : mData(data) {}
+	INLINE SimdDouble(const double x) : mData(_mm256_set1_pd(x)) {}
+
+	INLINE static SimdDouble load(const double* p) { return _mm256_load_pd(p); }
+	INLINE static SimdDouble loadUnaligned(const double* p) { return _mm256_loadu_pd(p); }
+	INLINE void store(double* p) const { _mm256_store_pd(p, mData); }
+	INLINE void storeUnaligned(double* p) const { _mm256_storeu_pd(p, mData); }
+
+	INLINE SimdDouble operator+(const SimdDouble v) const { return _mm256_add_pd(mData, v.mData); }
+	INLINE SimdDouble operator-(const SimdDouble v) const { return _mm256_sub_pd(mData, v.mData); }
+	INLINE SimdDouble operator*(const SimdDouble v) const { return _mm256_mul_pd(mData, v.mData); }
+
+#if defined(__FMA__) || defined(_MSC_VER) // MSVC has no __FMA__, /arch:AVX2 implies FMA
+	INLINE friend SimdDouble fma(const SimdDouble a, const SimdDouble b, const SimdDouble c) { return _mm256_fmadd_pd(a.mData, b.mData, c.mData); }
+#else
+	INLINE friend SimdDouble fma(const SimdDouble a, const SimdDouble b, const SimdDouble c) { return a * b + c; }
+#endif
+	INLINE friend SimdDouble max(const SimdDouble a, const SimdDouble b) { return _mm256_max_pd(a.mData, b.mData); }
+	INLINE friend SimdDouble min(const SimdDouble a, const SimdDouble b) { return _mm256_min_pd(a.mData, b.mData); }
+	INLINE friend SimdDouble round(const SimdDouble a) { return _mm256_round_pd(a.mData, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	INLINE friend SimdDouble zeroBelow(const SimdDouble a, const SimdDouble limit, const SimdDouble value) {
+		return _mm256_and_pd(_mm256_cmp_pd(a.mData, limit.mData, _CMP_GE_OQ), value.mData);
+	}
+	INLINE friend SimdDouble pow2(const SimdDouble n) {
+		const __m256d biased = _mm256_add_pd(n.mData, _mm256_set1_pd(4503599627371519.0)); // 2^52 + 1023
+		return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(biased), 52));
+	}
+
+	INLINE double horizontalSum() const {
+		const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(mData), _mm256_extractf128_pd(mData, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+	}
+	INLINE double horizontalMax() const {
+		const __m128d pair = _mm_max_pd(_mm256_castpd256_pd128(mData), _mm256_extractf128_pd(mData, 1));
+		return _mm_cvtsd_f64(_mm_max_sd(pair, _mm_unpackhi_pd(pair, pair)));
+	}
+};
+#else
+class SimdDouble {
+	double mData;
+public:
+	static constexpr uint32_t WIDTH = 1;
+
+	INLINE SimdDouble() = default;
+	INLINE SimdDouble(const double x) : mData(x) {}
+
+	INLINE static SimdDouble load(const double* p) { return *p; }
+	INLINE static SimdDouble loadUnaligned(const double* p) { return *p; }
+	INLINE void store(double* p) const { *p = mData; }
+	INLINE void storeUnaligned(double* p) const { *p = mData; }
+
+	INLINE SimdDouble operator+(const SimdDouble v) const { return mData + v.mData; }
+	INLINE SimdDouble operator-(const SimdDouble v) const { return mData - v.mData; }
+	INLINE SimdDouble operator*(const SimdDouble v) const { return mData * v.mData; }
+
+	INLINE friend SimdDouble fma(const SimdDouble a, const SimdDouble b, const SimdDouble c) { return a.mData * b.mData + c.mData; }
+	INLINE friend SimdDouble max(const SimdDouble a, const SimdDouble b) { return std::max(a.mData, b.mData); }
+	INLINE friend SimdDouble min(const SimdDouble a, const SimdDouble b) { return std::min(a.mData, b.mData); }
+	INLINE friend SimdDouble round(const SimdDouble a) { return nearbyint(a.mData); }
+	INLINE friend SimdDouble zeroBelow(const SimdDouble a, const SimdDouble limit, const SimdDouble value) { return a.mData >= limit.mData ? value.mData : 0.0; }
+	INLINE friend SimdDouble pow2(const SimdDouble n) { return ldexp(1.0, int(n.mData)); }
+	INLINE friend SimdDouble exp(const SimdDouble x) { return ::exp(x.mData); }
+
+	INLINE double horizontalSum() const { return mData; }
+	INLINE double horizontalMax() const { return mData; }
+};
+#endif
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+// Vectorized exp: x = n ln2 + r with |r| <= ln2/2, e^r by a degree 13 Taylor polynomial (error below 1e-17),
+// arguments below the double range (including -infinity) give zero
+INLINE SimdDouble exp(const SimdDouble x) {
+	const SimdDouble lowest(-708.0), highest(709.0);
+	const SimdDouble clamped = min(max(x, lowest), highest);
+	const SimdDouble n = round(clamped * SimdDouble(1.4426950408889634)); // log2(e)
+	const SimdDouble r = fma(n, SimdDouble(-1.4286068203094172e-06), fma(n, SimdDouble(-0.69314575195312500), clamped)); // ln2 split in two
+	SimdDouble p(1.0 / 6227020800.0);
+	p = fma(p, r, SimdDouble(1.0 / 479001600.0));
+	p = fma(p, r, SimdDouble(1.0 / 39916800.0));
+	p = fma(p, r, SimdDouble(1.0 / 3628800.0));
+	p = fma(p, r, SimdDouble(1.0 / 362880.0));
+	p = fma(p, r, SimdDouble(1.0 / 40320.0));
+	p = fma(p, r, SimdDouble(1.0 / 5040.0));
+	p = fma(p, r, SimdDouble(1.0 / 720.0));
+	p = fma(p, r, SimdDouble(1.0 / 120.0));
+	p = fma(p, r, SimdDouble(1.0 / 24.0));
+	p = fma(p, r, SimdDouble(1.0 / 6.0));
+	p = fma(p, r, SimdDouble(0.5));
+	p = fma(p, r, SimdDouble(1.0));
+	p = fma(p, r, SimdDouble(1.0));
+	return zeroBelow(x, lowest, p * pow2(n));
+}
+#endif
+
+// Pack of floats, twice the lanes of SimdDouble
+#if defined(__AVX512F__)
+class SimdFloat {
+	__m512 mData;
+public:
+	static constexpr uint32_t WIDTH = 16;
+
+	INLINE SimdFloat() = default;
+	INLINE SimdFloat(const __m512 data) : mData(data) {}
+	INLINE SimdFloat(const float x) : mData(_mm512_set1_ps(x)) {}
+
+	INLINE static SimdFloat load(const float* p) { return _mm512_load_ps(p); }
+	INLINE static SimdFloat loadUnaligned(const float* p) { return _mm512_loadu_ps(p); }
+	INLINE void store(float* p) const { _mm512_store_ps(p, mData); }
+	INLINE void storeUnaligned(float* p) const { _mm512_storeu_ps(p, mData); }
+
+	INLINE SimdFloat operator+(const SimdFloat v) const { return _mm512_add_ps(mData, v.mData); }
+	INLINE SimdFloat operator-(const SimdFloat v) const { return _mm512_sub_ps(mData, v.mData); }
+	INLINE SimdFloat operator*(const SimdFloat v) const { return _mm512_mul_ps(mData, v.mData); }
+
+	INLINE friend SimdFloat fma(const SimdFloat a, const SimdFloat b, const SimdFloat c) { return _mm512_fmadd_ps(a.mData, b.mData, c.mData); }
+	INLINE friend SimdFloat max(const SimdFloat a, const SimdFloat b) { return _mm512_max_ps(a.mData, b.mData); }
+	INLINE friend SimdFloat min(const SimdFloat a, const SimdFloat b) { return _mm512_min_ps(a.mData, b.mData); }
+	INLINE friend SimdFloat round(const SimdFloat a) { return _mm512_roundscale_ps(a.mData, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	INLINE friend SimdFloat zeroBelow(const SimdFloat a, const SimdFloat limit, const SimdFloat value) {
+		return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a.mData, limit.mData, _CMP_GE_OQ), value.mData);
+	}
+	// 2^n for integral n in [-126, 127]
+	INLINE friend SimdFloat pow2(const SimdFloat n) {
+		const __m512 biased = _mm512_add_ps(n.mData, _mm512_set1_ps(8388735.0f)); // 2^23 + 127
+		return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_castps_si512(biased), 23));
+	}
+
+	INLINE float horizontalSum() const { return _mm512_reduce_add_ps(mData); }
+	INLINE float horizontalMax() const { return _mm512_reduce_max_ps(mData); }
+};
+#elif defined(__AVX2__)
+class SimdFloat {
+	__m256 mData;
+public:
+	static constexpr uint32_t WIDTH = 8;
+
+	INLINE SimdFloat() = default;
+	INLINE SimdFloat(const __m256 data) : mData(data) {}
+	INLINE SimdFloat(const float x) : mData(_mm256_set1_ps(x)) {}
+
+	INLINE static SimdFloat load(const float* p) { return _mm256_load_ps(p); }
+	INLINE static SimdFloat loadUnaligned(const float* p) { return _mm256_loadu_ps(p); }
+	INLINE void store(float* p) const { _mm256_store_ps(p, mData); }
+	INLINE void storeUnaligned(float* p) const { _mm256_storeu_ps(p, mData); }
+
+	INLINE SimdFloat operator+(const SimdFloat v) const { return _mm256_add_ps(mData, v.mData); }
+	INLINE SimdFloat operator-(const SimdFloat v) const { return _mm256_sub_ps(mData, v.mData); }
+	INLINE SimdFloat operator*(const SimdFloat v) const { return _mm256_mul_ps(mData, v.mData); }
+
+#if defined(__FMA__) || defined(_MSC_VER)
+	INLINE friend SimdFloat fma(const SimdFloat a, const SimdFloat b, const SimdFloat c) { return _mm256_fmadd_ps(a.mData, b.mData, c.mData); }
+#else
+	INLINE friend SimdFloat fma(const SimdFloat a, const SimdFloat b, const SimdFloat c) { return a * b + c; }
+#endif
+	INLINE friend SimdFloat max(const SimdFloat a, const SimdFloat b) { return _mm256_max_ps(a.mData, b.mData); }
+	INLINE friend SimdFloat min(const SimdFloat a, const SimdFloat b) { return _mm256_min_ps(a.mData, b.mData); }
+	INLINE friend SimdFloat round(const SimdFloat a) { return _mm256_round_ps(a.mData, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	INLINE friend SimdFloat zeroBelow(const SimdFloat a, const SimdFloat limit, const SimdFloat value) {
+		return _mm256_and_ps(_mm256_cmp_ps(a.mData, limit.mData, _CMP_GE_OQ), value.mData);
+	}
+	INLINE friend SimdFloat pow2(const SimdFloat n) {
+		const __m256 biased = _mm256_add_ps(n.mData, _mm256_set1_ps(8388735.0f)); // 2^23 + 127
+		return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_castps_si256(biased), 23));
+	}
+
+	INLINE float horizontalSum() const {
+		__m128 quad = _mm_add_ps(_mm256_castps256_ps128(mData), _mm256_extractf128_ps(mData, 1));
+		quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+		return _mm_cvtss_f32(_mm_add_ss(quad, _mm_movehdup_ps(quad)));
+	}
+	INLINE float horizontalMax() const {
+		__m128 quad = _mm_max_ps(_mm256_castps256_ps128(mData), _mm256_extractf128_ps(mData, 1));
+		quad = _mm_max_ps(quad, _mm_movehl_ps(quad, quad));
+		return _mm_cvtss_f32(_mm_max_ss(quad, _mm_movehdup_ps(quad)));
+	}
+};
+#else
+class SimdFloat {
+	float mData;
+public:
+	static constexpr uint32_t WIDTH = 1;
+
+	INLINE SimdFloat() = default;
+	INLINE SimdFloat(const float x) : mData(x) {}
+
+	INLINE static SimdFloat load(const float* p) { return *p; }
+	INLINE static SimdFloat loadUnaligned(const float* p) { return *p; }
+	INLINE void store(float* p) const { *p = mData; }
+	INLINE void storeUnaligned(float* p) const { *p = mData; }
+
+	INLINE SimdFloat operator+(const SimdFloat v) const { return mData + v.mData; }
+	INLINE SimdFloat operator-(const SimdFloat v) const { return mData - v.mData; }
+	INLINE SimdFloat operator*(const SimdFloat v) const { return mData * v.mData; }
+
+	INLINE friend SimdFloat fma(const SimdFloat a, const SimdFloat b, const SimdFloat c) { return a.mData * b.mData + c.mData; }
+	INLINE friend SimdFloat max(const SimdFloat a, const SimdFloat b) { return std::max(a.mData, b.mData); }
+	INLINE friend SimdFloat min(const SimdFloat a, const SimdFloat b) { return std::min(a.mData, b.mData); }
+	INLINE friend SimdFloat round(const SimdFloat a) { return nearbyintf(a.mData); }
+	INLINE friend SimdFloat zeroBelow(const SimdFloat a, const SimdFloat limit, const SimdFloat value) { return a.mData >= limit.mData ? value.mData : 0.0f; }
+	INLINE friend SimdFloat pow2(const SimdFloat n) { return ldexpf(1.0f, int(n.mData)); }
+	INLINE friend SimdFloat exp(const SimdFloat x) { return expf(x.mData); }
+
+	INLINE float horizontalSum() const { return mData; }
+	INLINE float horizontalMax() const { return mData; }
+};
+#endif
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+// Same scheme as the double exp with a degree 7 polynomial (error below 1e-8), zero below the float range
+INLINE SimdFloat exp(const SimdFloat x) {
+	const SimdFloat lowest(-87.0f), highest(88.0f);
+	const SimdFloat clamped = min(max(x, lowest), highest);
+	const SimdFloat n = round(clamped * SimdFloat(1.44269504f)); // log2(e)
+	const SimdFloat r = fma(n, SimdFloat(2.12194440e-4f), fma(n, SimdFloat(-0.693359375f), clamped)); // ln2 split in two
+	SimdFloat p(1.0f / 5040.0f);
+	p = fma(p, r, SimdFloat(1.0f / 720.0f));
+	p = fma(p, r, SimdFloat(1.0f / 120.0f));
+	p = fma(p, r, SimdFloat(1.0f / 24.0f));
+	p = fma(p, r, SimdFloat(1.0f / 6.0f));
+	p = fma(p, r, SimdFloat(0.5f));
+	p = fma(p, r, SimdFloat(1.0f));
+	p = fma(p, r, SimdFloat(1.0f));
+	return zeroBelow(x, lowest, p * pow2(n));
+}
+#endif
+
+// The pack matching a precision
+template<typename TFloat>
+struct SimdOf;
+
+template<>
+struct SimdOf<double> {
+	using Type = SimdDouble;
+};
+
+template<>
+struct SimdOf<float> {
+	using Type = SimdFloat;
+};
+
+template<typename TFloat>
+using Simd = typename SimdOf<TFloat>::Type;
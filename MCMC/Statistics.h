@@ -4,28 +4,46 @@
 #include "Bitmap.h"
 #include "Integrand.h"
 #include "SampleAndPdf.h"
+#include "Parallel.h"
+#include "EffectiveSampleSize.h"
 #include <iostream>
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 struct AlgStats {
-	Float avgSecMomentDiff, worstSecMomentDiff, bestSecMomentDiff;
-	Float avgMiss, worstMiss, bestMiss;
-	Float avgModesDiff, worstModesDiff, bestModesDiff;
+	double avgSecMomentDiff, worstSecMomentDiff, bestSecMomentDiff;
+	double avgMiss, worstMiss, bestMiss;
+	double avgModesDiff, worstModesDiff, bestModesDiff;
+	double avgEss, avgEssPerSecond, avgEssPerEvaluation; // Of the slowest series of a run, zero when not measured
 	std::string algName;
 };
 
-template<uint32_t TDimension>
+// The accumulations are in double whatever the precision of the sampled algorithm
+template<uint32_t TDimension, typename TFloat = Float>
 class Statistics {
+public:
 	class RunStats {
-		Float mSquares;
+		double mSquares;
 		uint32_t mSamples;
 		std::vector<uint32_t> mModes;
+		// Effective sample sizes of the integrand value and of the worst coordinate, by autocorrelation and by batch means
+		double mEssValue, mEssCoordinates, mBatchEssValue, mBatchEssCoordinates;
+		double mSeconds;
 	public:
 		INLINE RunStats() = default;
 
-		INLINE RunStats(const uint32_t modeCount): mSquares(0), mSamples(0), mModes(modeCount, 0) {
+		INLINE RunStats(const uint32_t modeCount): mSquares(0), mSamples(0), mModes(modeCount, 0),
+			mEssValue(0), mEssCoordinates(0), mBatchEssValue(0), mBatchEssCoordinates(0), mSeconds(0) {
 		}
 		
 		INLINE uint32_t sampleCount() const {
@@ -56,62 +74,185 @@ class Statistics {
 			return hitsleast;
 		}
 
-		INLINE Float secondMoment() const {
+		INLINE double secondMoment() const {
 			return mSquares / mSamples;
 		}
 
-		INLINE void addSample(const Float integrandValue, const Float pdf, const uint32_t mode) {
+		INLINE double essValue() const {
+			return mEssValue;
+		}
+
+		INLINE double essCoordinates() const {
+			return mEssCoordinates;
+		}
+
+		INLINE double batchEssValue() const {
+			return mBatchEssValue;
+		}
+
+		INLINE double batchEssCoordinates() const {
+			return mBatchEssCoordinates;
+		}
+
+		// The smaller of the two by autocorrelation
+		INLINE double ess() const {
+			return std::min(mEssValue, mEssCoordinates);
+		}
+
+		INLINE void setEss(const double value, const double coordinates, const double batchValue, const double batchCoordinates) {
+			mEssValue = value;
+			mEssCoordinates = coordinates;
+			mBatchEssValue = batchValue;
+			mBatchEssCoordinates = batchCoordinates;
+		}
+
+		// Time the algorithm took for the run, zero when not measured
+		INLINE double seconds() const {
+			return mSeconds;
+		}
+
+		INLINE void setSeconds(const double seconds) {
+			mSeconds = seconds;
+		}
+
+		INLINE void addSample(const double integrandValue, const double pdf, const uint32_t mode) {
 			if (integrandValue > 0) {
 				++mModes[mode];
 			}
 			mSquares += integrandValue * integrandValue / pdf;
 			++mSamples;
 		}
+
+		// Of the samples that follow the ones of this, the effective sample sizes are of whole runs only
+		INLINE void merge(const RunStats& other) {
+			mSquares += other.mSquares;
+			mSamples += other.mSamples;
+			for (uint32_t m = 0; m < uint32_t(mModes.size()); ++m) {
+				mModes[m] += other.mModes[m];
+			}
+		}
 	};
-	std::vector<Vector<TDimension>> mSamples;
-	const Integrand<TDimension> mIntegrand;
+private:
+	// Runs are evaluated in chunks of this many samples, merged in order, so the sums do not depend on the thread count
+	static constexpr uint32_t EVALUATION_CHUNK = 4096;
+	// Batches kept by the effective sample size of every series, longer runs are batched further
+	static constexpr uint32_t ESS_BATCHES = 1 << 16;
+	const Integrand<TDimension, TFloat> mIntegrand;
 	std::vector<RunStats> mRuns;
-	Float mRefSecondMoment, mRefFirstMoment;
+	double mRefSecondMoment, mRefFirstMoment;
 	const uint32_t mResolution;
+	std::vector<uint32_t> mBins; // The TDimension / 2 histograms of the dimension pairs, [(pair * resolution + i2) * resolution + i1]
 	std::vector<AlgStats> mOverAllStats;
 public:
-	INLINE Statistics(const Integrand<TDimension> &integrand, const uint32_t resolution):mIntegrand(integrand), mResolution(resolution) {
-		mRefSecondMoment = Float(0);
-		mRefFirstMoment = Float(0);
+	// With a cache directory and a key that identifies the integrand (the same key must mean the same integrand), the
+	// reference moments and the integrand histograms are read from the cache file of the key, or computed and written
+	// there. An empty directory computes them every time. Zero reference samples means the default count, zero threads
+	// all hardware threads, the reference does not depend on the thread count
+	INLINE Statistics(const Integrand<TDimension, TFloat> &integrand, const uint32_t resolution, const std::string& cacheDirectory = std::string(),
+		const std::string& integrandKey = std::string(), uint32_t referenceSamples = 0, const uint32_t threadCount = 1):mIntegrand(integrand), mResolution(resolution) {
+		mRefSecondMoment = 0.0;
+		mRefFirstMoment = 0.0;
+		mBins.assign(size_t(TDimension / 2) * resolution * resolution, 0);
+		if (referenceSamples == 0) {
 #ifdef _DEBUG
-		mSamples.reserve(1000);
+			referenceSamples = 1000;
 #else
-		mSamples.reserve(1000000);
+			referenceSamples = 1000000;
 #endif
-		
-		for (uint32_t i = 0; i < uint32_t(mSamples.capacity()); ++i) {
-			const auto s = integrand.getDistribution().sample(haltonVector<TDimension>(i));
-			const Float v = integrand.value(s, Float(1));
-			mRefFirstMoment += ((v / integrand.getDistribution().pdf(s)) - mRefFirstMoment) / (i + 1);
-			mRefSecondMoment += ((v * v / integrand.getDistribution().pdf(s)) - mRefSecondMoment) / (i + 1);
-			if (mIntegrand.inside(s)) {
-				mSamples.push_back(s);
+		}
+		std::ostringstream key;
+		key << "reference v2 " << integrandKey << " dimension " << TDimension << " float " << sizeof(TFloat) << " samples " << referenceSamples << " resolution " << resolution;
+		const std::string cacheFile = cacheDirectory.empty() ? std::string() : cacheDirectory + "/reference-" + hashName(key.str()) + ".cache";
+		if (cacheFile.empty() || !readReference(cacheFile, key.str())) {
+			integrateReference(referenceSamples, threadCount);
+			if (!cacheFile.empty()) {
+				writeReference(cacheFile, key.str());
 			}
 		}
 		histogram("Integrand");
-		mSamples.clear();
+		std::fill(mBins.begin(), mBins.end(), 0);
 	}
 
-	INLINE void addRunResult(const std::vector<SampleAndPdf<TDimension>>& samples, const bool hasNormalizedPdf) {
-		mRuns.push_back(RunStats(mIntegrand.modeCount()));
-		mSamples.clear();
-		const Float pdfNormalization = hasNormalizedPdf ? Float(1) : mRefFirstMoment;
-		for (const auto& s : samples) {
-			if (mIntegrand.inside(s.sample)) {
-				mSamples.push_back(s.sample);
+	INLINE void addRunResult(const std::vector<SampleAndPdf<TDimension, TFloat>>& samples, const bool hasNormalizedPdf) {
+		addRunResult(evaluateRun(samples, hasNormalizedPdf));
+		setHistogramSamples(samples);
+	}
+
+	// Thread safe, the result is merged later by addRunResult. With a pool the chunks are evaluated in parallel, as many at
+	// a time as it has threads, and then the series of the effective sample sizes fed from them in parallel, so only those
+	// chunks are kept. It must not be called from a task of the same pool
+	INLINE RunStats evaluateRun(const std::vector<SampleAndPdf<TDimension, TFloat>>& samples, const bool hasNormalizedPdf, ThreadPool* pool = nullptr) const {
+		const double pdfNormalization = hasNormalizedPdf ? 1.0 : mRefFirstMoment;
+		const uint32_t group = pool ? pool->threadCount() : 1;
+		const size_t groupSamples = size_t(group) * EVALUATION_CHUNK;
+		std::vector<RunStats> chunks(group, RunStats(mIntegrand.modeCount()));
+		std::vector<double> values(std::min(samples.size(), groupSamples));
+		// The coordinates and then the integrand value, every series streamed in the order of the samples
+		std::vector<EffectiveSampleSize> series(TDimension + 1, EffectiveSampleSize(ESS_BATCHES));
+		RunStats run(mIntegrand.modeCount());
+		for (size_t first = 0; first < samples.size(); first += groupSamples) {
+			const size_t last = std::min(samples.size(), first + groupSamples);
+			const uint32_t chunkCount = uint32_t((last - first + EVALUATION_CHUNK - 1) / EVALUATION_CHUNK);
+			const auto evaluateChunk = [&](const uint32_t chunk, const uint32_t) {
+				chunks[chunk] = RunStats(mIntegrand.modeCount());
+				const size_t begin = first + size_t(chunk) * EVALUATION_CHUNK, end = std::min(last, begin + EVALUATION_CHUNK);
+				for (size_t i = begin; i < end; ++i) {
+					uint32_t mode;
+					values[i - first] = mIntegrand.valueAndMode(samples[i].sample, mode);
+					chunks[chunk].addSample(values[i - first], samples[i].pdf / pdfNormalization, mode);
+				}
+			};
+			const auto feedSeries = [&](const uint32_t s, const uint32_t) {
+				for (size_t i = first; i < last; ++i) {
+					series[s].add(s < TDimension ? double(samples[i].sample[s]) : values[i - first]);
+				}
+			};
+			if (pool) {
+				pool->parallelFor(chunkCount, evaluateChunk);
+				pool->parallelFor(TDimension + 1, feedSeries);
+			}
+			else {
+				evaluateChunk(0, 0);
+				for (uint32_t s = 0; s <= TDimension; ++s) {
+					feedSeries(s, 0);
+				}
+			}
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+				run.merge(chunks[chunk]);
 			}
-			const Float value = mIntegrand.value(s.sample, Float(1));
-			mRuns.back().addSample(value, s.pdf / pdfNormalization, mIntegrand.mode(s.sample));
+		}
+		std::vector<double> autocorrelation(TDimension + 1), batchMeans(TDimension + 1);
+		const auto diagnoseSeries = [&](const uint32_t s, const uint32_t) {
+			autocorrelation[s] = series[s].autocorrelation();
+			batchMeans[s] = series[s].batchMeans();
+		};
+		if (pool) {
+			pool->parallelFor(TDimension + 1, diagnoseSeries);
+		}
+		else {
+			for (uint32_t s = 0; s <= TDimension; ++s) {
+				diagnoseSeries(s, 0);
+			}
+		}
+		run.setEss(autocorrelation[TDimension], *std::min_element(autocorrelation.begin(), autocorrelation.end() - 1),
+			batchMeans[TDimension], *std::min_element(batchMeans.begin(), batchMeans.end() - 1));
+		return run;
+	}
+
+	INLINE void addRunResult(const RunStats& run) {
+		mRuns.push_back(run);
+	}
+
+	// Bins the samples into the histograms right away, nothing of the run is kept
+	INLINE void setHistogramSamples(const std::vector<SampleAndPdf<TDimension, TFloat>>& samples) {
+		std::fill(mBins.begin(), mBins.end(), 0);
+		for (const auto& s : samples) {
+			addToHistograms(s.sample);
 		}
 	}
 
 	INLINE void clear() {
-		mSamples.clear();
+		std::fill(mBins.begin(), mBins.end(), 0);
 		mRuns.clear();
 	}
 
@@ -119,13 +260,14 @@ public:
 		return uint32_t(mRuns.size());
 	}
 
-	INLINE void computeAndPrintStats(const std::string& algName) {
+	// The evaluations are the integrand evaluations of the algorithm per run, zero when not counted
+	INLINE void computeAndPrintStats(const std::string& algName, const double evaluationsPerRun = 0) {
 		std::cout << std::right;
 		std::cout << "============================================================" << std::endl;
 		std::cout << algName << std::endl << std::endl;
 		uint32_t i = 0;
 		std::cout << std::fixed << std::setfill(' ');
-		auto printLine = [this](const Float secondMomentDiff, const Float miss, const Float modesDiff, const bool endLine = true) {
+		auto printLine = [this](const double secondMomentDiff, const double miss, const double modesDiff, const bool endLine = true) {
 			std::cout << std::setprecision(5) << " Second moment diff: " << std::setw(11) << secondMomentDiff << " %";
 			std::cout << std::setprecision(5) << " Modes miss: " << std::setw(11) << miss << " %";
 			std::cout << std::setprecision(5) << " Modes diff: " << std::setw(11) << modesDiff << " %";
@@ -146,9 +288,9 @@ public:
 		result.worstModesDiff = Float(0);
 		result.bestModesDiff = 10e7;
 		for (const auto& run : mRuns) {
-			const Float diff = Float(100) * abs(run.secondMoment()/ mRefSecondMoment - 1.f);
-			const Float miss = Float(100) * Float(mIntegrand.modeCount() - run.modesHit()) / mIntegrand.modeCount();
-			const Float modesDiff = Float(100) * Float(run.mostModeVisits() - run.leastModeVisits()) / run.sampleCount();
+			const double diff = 100.0 * abs(run.secondMoment()/ mRefSecondMoment - 1.f);
+			const double miss = 100.0 * double(mIntegrand.modeCount() - run.modesHit()) / mIntegrand.modeCount();
+			const double modesDiff = 100.0 * double(run.mostModeVisits() - run.leastModeVisits()) / run.sampleCount();
 			std::cout << "Run #" << std::setw(3) << (++i);
 			printLine(diff, miss, modesDiff, false);
 			std::cout << "(M: " << std::setw(5) << run.mostModeVisits() << " L: " << std::setw(5) << run.leastModeVisits() << ")" << std::endl;
@@ -174,6 +316,41 @@ public:
 		std::cout << "WORST   ";
 		printLine(result.worstSecMomentDiff, result.worstMiss, result.worstModesDiff);
 		std::cout << std::endl;
+
+		// Averages over the runs, the rates are of the slower of the value and the worst coordinate of every run
+		double essValue = 0, essCoordinates = 0, batchEssValue = 0, batchEssCoordinates = 0, seconds = 0;
+		result.avgEss = 0;
+		result.avgEssPerSecond = 0;
+		result.avgEssPerEvaluation = 0;
+		for (const auto& run : mRuns) {
+			essValue += run.essValue();
+			essCoordinates += run.essCoordinates();
+			batchEssValue += run.batchEssValue();
+			batchEssCoordinates += run.batchEssCoordinates();
+			seconds += run.seconds();
+			result.avgEss += run.ess();
+			if (run.seconds() > 0) {
+				result.avgEssPerSecond += run.ess() / run.seconds();
+			}
+		}
+		result.avgEss /= mRuns.size();
+		result.avgEssPerSecond /= mRuns.size();
+		if (evaluationsPerRun > 0) {
+			result.avgEssPerEvaluation = result.avgEss / evaluationsPerRun;
+		}
+		std::cout << std::setprecision(1) << "ESS autocorrelation  value: " << std::setw(11) << essValue / mRuns.size()
+			<< " worst coordinate: " << std::setw(11) << essCoordinates / mRuns.size() << std::endl;
+		std::cout << std::setprecision(1) << "ESS batch means      value: " << std::setw(11) << batchEssValue / mRuns.size()
+			<< " worst coordinate: " << std::setw(11) << batchEssCoordinates / mRuns.size() << std::endl;
+		if (seconds > 0) {
+			std::cout << std::setprecision(1) << "ESS per second       " << std::setw(18) << result.avgEssPerSecond
+				<< " (" << std::setprecision(3) << 1000.0 * seconds / mRuns.size() << " ms per run)" << std::endl;
+		}
+		if (evaluationsPerRun > 0) {
+			std::cout << std::setprecision(8) << "ESS per evaluation   " << std::setw(18) << result.avgEssPerEvaluation
+				<< " (" << std::setprecision(0) << evaluationsPerRun << " evaluations per run)" << std::endl;
+		}
+		std::cout << std::endl;
 		mOverAllStats.push_back(result);
 	}
 
@@ -183,6 +360,8 @@ public:
 			bestAvgModesDiff = mOverAllStats[0], bestBestModesDiff = mOverAllStats[0], bestWorstModesDiff = mOverAllStats[0];
 		AlgStats worstAvgDiff = mOverAllStats[0], worstAvgMiss = mOverAllStats[0], worstBestDiff = mOverAllStats[0], worstBestMiss = mOverAllStats[0], worstWorstDiff = mOverAllStats[0], worstWorstMiss = mOverAllStats[0],
 			worstAvgModesDiff = mOverAllStats[0], worstBestModesDiff = mOverAllStats[0], worstWorstModesDiff = mOverAllStats[0];
+		// Higher is better
+		AlgStats bestEssPerSecond = mOverAllStats[0], bestEssPerEvaluation = mOverAllStats[0], worstEssPerSecond = mOverAllStats[0], worstEssPerEvaluation = mOverAllStats[0];
 		for (const auto& algStats : mOverAllStats) {
 			//BEST
 			if (bestAvgDiff.avgSecMomentDiff > algStats.avgSecMomentDiff) {
@@ -212,6 +391,12 @@ public:
 			if (bestWorstModesDiff.worstModesDiff > algStats.worstModesDiff) {
 				bestWorstModesDiff = algStats;
 			}
+			if (bestEssPerSecond.avgEssPerSecond < algStats.avgEssPerSecond) {
+				bestEssPerSecond = algStats;
+			}
+			if (bestEssPerEvaluation.avgEssPerEvaluation < algStats.avgEssPerEvaluation) {
+				bestEssPerEvaluation = algStats;
+			}
 			//WORST
 			if (worstAvgDiff.avgSecMomentDiff < algStats.avgSecMomentDiff) {
 				worstAvgDiff = algStats;
@@ -240,11 +425,17 @@ public:
 			if (worstWorstModesDiff.worstModesDiff < algStats.worstModesDiff) {
 				worstWorstModesDiff = algStats;
 			}
+			if (worstEssPerSecond.avgEssPerSecond > algStats.avgEssPerSecond) {
+				worstEssPerSecond = algStats;
+			}
+			if (worstEssPerEvaluation.avgEssPerEvaluation > algStats.avgEssPerEvaluation) {
+				worstEssPerEvaluation = algStats;
+			}
 		}
 
-		auto printLine = [this](const std::string& category, const AlgStats& stats, const Float value) {
+		auto printLine = [this](const std::string& category, const AlgStats& stats, const double value, const char* unit = " %", const int precision = 5) {
 			std::cout << std::left << std::setw(20) << std::setfill(' ') << category << std::setw(20) << stats.algName
-				      << " " << std::right << std::setw(11) << std::setprecision(5) << value << " %" << std::endl;
+				      << " " << std::right << std::setw(11) << std::setprecision(precision) << value << unit << std::endl;
 		};
 
 
@@ -261,6 +452,8 @@ public:
 		printLine("Worst diff: ", bestWorstDiff, bestWorstDiff.worstSecMomentDiff);
 		printLine("Worst miss: ", bestWorstMiss, bestWorstMiss.worstMiss);
 		printLine("Worst modes diff: ", bestWorstModesDiff, bestWorstModesDiff.worstModesDiff);
+		printLine("ESS per second: ", bestEssPerSecond, bestEssPerSecond.avgEssPerSecond, "");
+		printLine("ESS per eval: ", bestEssPerEvaluation, bestEssPerEvaluation.avgEssPerEvaluation, "", 8);
 		std::cout << std::endl;
 
 		std::cout << "WORST" << std::endl;
@@ -273,6 +466,8 @@ public:
 		printLine("Worst diff: ", worstWorstDiff, worstWorstDiff.worstSecMomentDiff);
 		printLine("Worst miss: ", worstWorstMiss, worstWorstMiss.worstMiss);
 		printLine("Worst modes diff: ", worstWorstModesDiff, worstWorstModesDiff.worstModesDiff);
+		printLine("ESS per second: ", worstEssPerSecond, worstEssPerSecond.avgEssPerSecond, "");
+		printLine("ESS per eval: ", worstEssPerEvaluation, worstEssPerEvaluation.avgEssPerEvaluation, "", 8);
 		std::cout << std::endl;
 		std::cout << "============================================================" << std::endl;
 	}
@@ -281,17 +476,17 @@ public:
 		for (int d = 0; d < TDimension / 2; ++d) {
 			std::ostringstream oss;
 			oss << (2 * d + 1) << "," << (2*d + 2) << "-" << name << ".bmp";
-			histogram(2 * d, 2 * d + 1).save(oss.str().c_str());
+			pairHistogram(d).save(oss.str().c_str());
 		}
 	}
 
-	INLINE Bitmap integrand(const uint32_t dim1, const uint32_t dim2, const uint32_t mResolution, const Float invTemperature) const {
+	INLINE Bitmap integrand(const uint32_t dim1, const uint32_t dim2, const uint32_t mResolution, const TFloat invTemperature) const {
 		Bitmap out(mResolution, mResolution);
-		Float highestValue(0);
+		TFloat highestValue(0);
 		auto getPos = [this, dim1, dim2, mResolution](const uint32_t i1, const uint32_t i2) {
-			Vector<TDimension> v(0.5f);
-			v[dim1] = (i1 + Float(0.5)) / Float(mResolution);
-			v[dim2] = (i2 + Float(0.5)) / Float(mResolution);
+			Vector<TDimension, TFloat> v(0.5f);
+			v[dim1] = (i1 + TFloat(0.5)) / TFloat(mResolution);
+			v[dim2] = (i2 + TFloat(0.5)) / TFloat(mResolution);
 			return v;
 		};
 		for (uint32_t i1 = 0; i1 < mResolution; ++i1) {
@@ -308,19 +503,150 @@ public:
 	}
 
 private:
+	// Halton indices are cut into chunks of this many, every chunk has its own sums and they are added in order
+	static constexpr uint32_t REFERENCE_CHUNK = 1 << 16;
 
-	INLINE Bitmap histogram(const uint32_t dim1, const uint32_t dim2) const {
-		Bitmap out(mResolution, mResolution);
-		std::vector<uint32_t> bins(mResolution * mResolution, 0);
-		const auto index = [this](const Float value) {
-			return std::min(uint32_t(value * mResolution), mResolution - 1);
+	// The moments of the integrand over the mixture it is made of, which samples it exactly: the value is the pdf inside the
+	// unit cube and zero outside, so the first moment is the mass inside and the second one the mean value. The histograms
+	// are counted atomically with more threads (the counts are exact, so they do not depend on the thread count either)
+	void integrateReference(const uint32_t referenceSamples, const uint32_t threadCount) {
+		const uint32_t chunkCount = (referenceSamples + REFERENCE_CHUNK - 1) / REFERENCE_CHUNK;
+		std::vector<CompensatedSum> firstSums(chunkCount), secondSums(chunkCount);
+		std::unique_ptr<ThreadPool> pool;
+		std::vector<std::atomic<uint32_t>> sharedBins;
+		if (threadCount != 1) {
+			pool.reset(new ThreadPool(threadCount));
+			sharedBins = std::vector<std::atomic<uint32_t>>(mBins.size());
+		}
+		const auto integrateChunk = [&](const uint32_t chunk, const uint32_t) {
+			const uint32_t end = uint32_t(std::min(uint64_t(referenceSamples), uint64_t(chunk + 1) * REFERENCE_CHUNK));
+			for (uint32_t i = chunk * REFERENCE_CHUNK; i < end; ++i) {
+				const auto s = mIntegrand.getDistribution().sample(haltonVector<TDimension, TFloat>(i));
+				const double pdf = mIntegrand.getDistribution().pdf(s);
+				const double v = mIntegrand.inside(s) ? pdf : 0.0; // value(s, 1) without evaluating the mixture again
+				firstSums[chunk].add(v / pdf);
+				secondSums[chunk].add(v * v / pdf);
+				if (pool) {
+					addToHistograms(s, [&sharedBins](const size_t bin) { sharedBins[bin].fetch_add(1, std::memory_order_relaxed); });
+				}
+				else {
+					addToHistograms(s);
+				}
+			}
 		};
-		for (const auto &v : mSamples) {
-			++bins[index(v[dim1]) + index(v[dim2]) * mResolution];
+		if (pool) {
+			pool->parallelFor(chunkCount, integrateChunk);
+			for (size_t bin = 0; bin < mBins.size(); ++bin) {
+				mBins[bin] = sharedBins[bin].load(std::memory_order_relaxed);
+			}
+		}
+		else {
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+				integrateChunk(chunk, 0);
+			}
+		}
+		CompensatedSum first, second;
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			first.add(firstSums[chunk]);
+			second.add(secondSums[chunk]);
+		}
+		mRefFirstMoment = first.result() / referenceSamples;
+		mRefSecondMoment = second.result() / referenceSamples;
+	}
+
+	// FNV-1a of the key, the file keeps the whole key to tell collisions apart
+	static std::string hashName(const std::string& key) {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (const char c : key) {
+			hash = (hash ^ uint8_t(c)) * 0x100000001B3ull;
+		}
+		std::ostringstream oss;
+		oss << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return oss.str();
+	}
+
+	// Key length and key, the two moments and the bins, false (and nothing changed) unless all of it matches
+	bool readReference(const std::string& file, const std::string& key) {
+		std::ifstream in(file, std::ios::binary);
+		uint64_t keyLength = 0;
+		if (!in.read(reinterpret_cast<char*>(&keyLength), sizeof(keyLength)) || keyLength != key.size()) {
+			return false;
+		}
+		std::string storedKey(key.size(), ' ');
+		double moments[2];
+		std::vector<uint32_t> bins(mBins.size());
+		if (!in.read(&storedKey[0], storedKey.size()) || storedKey != key || !in.read(reinterpret_cast<char*>(moments), sizeof(moments)) ||
+			!in.read(reinterpret_cast<char*>(bins.data()), bins.size() * sizeof(uint32_t))) {
+			return false;
 		}
+		mRefFirstMoment = moments[0];
+		mRefSecondMoment = moments[1];
+		mBins.swap(bins);
+		return true;
+	}
+
+	// Through a temporary file, so concurrent sweeps never read a partial one
+	void writeReference(const std::string& file, const std::string& key) const {
+		// Unique among the processes and the writes of this one, concurrent sweeps never share a temporary file
+		static std::atomic<uint64_t> writes(0);
+		std::ostringstream unique;
+#if defined(_WIN32)
+		unique << file << "." << _getpid();
+#else
+		unique << file << "." << getpid();
+#endif
+		unique << "." << writes.fetch_add(1, std::memory_order_relaxed) << ".tmp";
+		const std::string temporary = unique.str();
+		{
+			std::ofstream out(temporary, std::ios::binary);
+			const uint64_t keyLength = key.size();
+			const double moments[2] = { mRefFirstMoment, mRefSecondMoment };
+			out.write(reinterpret_cast<const char*>(&keyLength), sizeof(keyLength));
+			out.write(key.data(), key.size());
+			out.write(reinterpret_cast<const char*>(moments), sizeof(moments));
+			out.write(reinterpret_cast<const char*>(mBins.data()), mBins.size() * sizeof(uint32_t));
+			if (!out) {
+				std::cerr << "Cannot write the reference cache " << file << std::endl;
+				out.close();
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+#if defined(_WIN32)
+		std::remove(file.c_str()); // rename does not replace here, elsewhere it does so atomically
+#endif
+		if (std::rename(temporary.c_str(), file.c_str()) != 0) {
+			std::remove(temporary.c_str());
+		}
+	}
+
+	INLINE uint32_t binIndex(const TFloat value) const {
+		return std::min(uint32_t(value * mResolution), mResolution - 1);
+	}
+
+	INLINE void addToHistograms(const Vector<TDimension, TFloat>& v) {
+		addToHistograms(v, [this](const size_t bin) { ++mBins[bin]; });
+	}
+
+	// count(bin) for the bin of every dimension pair
+	template<typename TCount>
+	INLINE void addToHistograms(const Vector<TDimension, TFloat>& v, const TCount& count) const {
+		if (!mIntegrand.inside(v)) {
+			return;
+		}
+		for (uint32_t pair = 0; pair < TDimension / 2; ++pair) {
+			count((size_t(pair) * mResolution + binIndex(v[2 * pair + 1])) * mResolution + binIndex(v[2 * pair]));
+		}
+	}
+
+	// Of the dimensions 2 * pair and 2 * pair + 1
+	INLINE Bitmap pairHistogram(const uint32_t pair) const {
+		assert(pair < TDimension / 2);
+		Bitmap out(mResolution, mResolution);
+		const uint32_t* bins = &mBins[size_t(pair) * mResolution * mResolution];
 		uint32_t highestValue = 0;
-		for (auto c : bins) {
-			highestValue = std::max(c, highestValue);
+		for (uint32_t i = 0; i < mResolution * mResolution; ++i) {
+			highestValue = std::max(bins[i], highestValue);
 		}
 		for (uint32_t i1 = 0; i1 < mResolution; ++i1) {
 			for (uint32_t i2 = 0; i2 < mResolution; ++i2) {
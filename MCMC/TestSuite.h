@@ -11,44 +11,103 @@
 #include "EEM.h"
 #include "Statistics.h"
 #include "SampledSwaps.h"
+#include "Parallel.h"
 #include <sstream>
 #include <iostream>
+#include <functional>
+#include <chrono>
 
-template<uint32_t TDimension>
+template<uint32_t TDimension, typename TFloat = Float>
 class TestSuite {
 	static_assert(TDimension >= 2, "Dimension must be divisible by 2");
-	const Integrand<TDimension> mIntegrand;
-	Statistics<TDimension> mStats;
-	std::vector<Algorithm<TDimension> *> mAlgorithms;
+	const Integrand<TDimension, TFloat> mIntegrand;
+	Statistics<TDimension, TFloat> mStats;
+	std::vector<Algorithm<TDimension, TFloat> *> mAlgorithms;
+	// Create additional instances for the parallel runs
+	std::vector<std::function<Algorithm<TDimension, TFloat>*()>> mFactories;
 public:
+	// The reference of the statistics is cached in the directory, keyed by the mixture parameters, without one (the default) it
+	// is integrated every time. That is on all hardware threads unless told otherwise, with the default sample count for zero samples
 	TestSuite(const uint32_t countDistributions,
 		const Float minWeight,
 		const Float maxWeight,
 		const Float avgScale,
 		const Float diffScale,
-		const uint64_t seed):
-		mIntegrand(randomMixture<TDimension>(countDistributions, minWeight, maxWeight, avgScale, diffScale, seed)), 
-		mStats(mIntegrand, 1024) {
+		const uint64_t seed,
+		const std::string& cacheDirectory = std::string(),
+		const uint32_t referenceSamples = 0,
+		const uint32_t referenceThreadCount = 0):
+		mIntegrand(randomMixture<TDimension, TFloat>(countDistributions, minWeight, maxWeight, avgScale, diffScale, seed)), 
+		mStats(mIntegrand, 1024, cacheDirectory, mixtureKey(countDistributions, minWeight, maxWeight, avgScale, diffScale, seed), referenceSamples, referenceThreadCount) {
 	}
 
-	template<typename TAlgorithm, typename ... Types, typename = std::enable_if_t<std::is_base_of_v<Algorithm<TDimension>, TAlgorithm>>>
+	template<typename TAlgorithm, typename ... Types, typename = std::enable_if_t<std::is_base_of_v<Algorithm<TDimension, TFloat>, TAlgorithm>>>
 	void addAlgorithm(Types&& ... params) {
-		mAlgorithms.push_back(new TAlgorithm(mIntegrand, std::forward<Types>(params)...));
+		mFactories.push_back([this, params...]() -> Algorithm<TDimension, TFloat>* { return new TAlgorithm(mIntegrand, params...); });
+		mAlgorithms.push_back(mFactories.back()());
 	}
 
-	void runAll(const uint32_t runCount, const uint32_t samplesPerRun) {
-		std::vector<SampleAndPdf<TDimension>> samples(samplesPerRun);
-		for (auto * alg : mAlgorithms) {
+	// Every run gets its own substream, so the results do not depend on the thread count (zero means all hardware threads).
+	// At most PCG_MAX_RUNS runs, more would repeat the streams of the first ones
+	void runAll(const uint32_t runCount, const uint32_t samplesPerRun, const uint32_t threadCount = 1) {
+		if (runCount > PCG_MAX_RUNS) {
+			throw std::invalid_argument("At most " + std::to_string(PCG_MAX_RUNS) + " runs have their own random streams");
+		}
+		ThreadPool pool(threadCount);
+		std::vector<std::vector<SampleAndPdf<TDimension, TFloat>>> samples(pool.threadCount(), std::vector<SampleAndPdf<TDimension, TFloat>>(samplesPerRun));
+		std::vector<typename Statistics<TDimension, TFloat>::RunStats> results(runCount);
+		std::mutex outputMutex;
+		for (uint32_t a = 0; a < uint32_t(mAlgorithms.size()); ++a) {
+			Algorithm<TDimension, TFloat>* alg = mAlgorithms[a];
+			// The first thread uses the registered instance, the other ones of parallel runs get their own. With more threads
+			// a single run borrows the pool of the suite and parallel runs keep the algorithms on their own threads (the
+			// pools of the algorithms are only created by runs that use them). One thread leaves the algorithms their pools
+			std::vector<Algorithm<TDimension, TFloat>*> instances(runCount == 1 ? 1 : pool.threadCount(), alg);
+			for (uint32_t t = 0; t < uint32_t(instances.size()); ++t) {
+				if (t > 0) {
+					instances[t] = mFactories[a]();
+				}
+				if (pool.threadCount() > 1) {
+					instances[t]->setPool(runCount == 1 ? &pool : nullptr);
+				}
+			}
 			mStats.clear();
+			const uint64_t evaluations = mIntegrand.evaluations();
 			std::cout << "Executing " << runCount << " runs of " << alg->name();
-			for (uint32_t r = 0; r < runCount; ++r) {
-				alg->run(samples);
-				mStats.addRunResult(samples, alg->hasNormalizedPdf());
+			// A single run leaves the threads to the algorithm and then to the evaluation of its samples
+			const auto runOne = [&](const uint32_t r, const uint32_t t, ThreadPool* evaluationPool) {
+				instances[t]->seed(Pcg(0xDEAD).stream(r, PCG_RUN_STREAM));
+				const auto start = std::chrono::steady_clock::now();
+				instances[t]->run(samples[t]);
+				const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				results[r] = mStats.evaluateRun(samples[t], instances[t]->hasNormalizedPdf(), evaluationPool);
+				results[r].setSeconds(elapsed.count());
+				if (r + 1 == runCount) {
+					mStats.setHistogramSamples(samples[t]);
+				}
+				std::lock_guard<std::mutex> lock(outputMutex);
 				std::cout << ".";
+			};
+			if (runCount == 1) {
+				runOne(0, 0, &pool);
+			}
+			else {
+				pool.parallelFor(runCount, [&](const uint32_t r, const uint32_t t) {
+					runOne(r, t, nullptr);
+				});
 			}
 			std::cout << std::endl;
+			for (const auto& result : results) {
+				mStats.addRunResult(result);
+			}
+			alg->restorePool();
+			for (uint32_t t = 1; t < uint32_t(instances.size()); ++t) {
+				alg->mergeStats(*instances[t]);
+				delete instances[t];
+			}
 			mStats.histogram(alg->name());
-			mStats.computeAndPrintStats(alg->name());
+			// The evaluations of all runs are counted together, the runs of one algorithm evaluate about as many
+			mStats.computeAndPrintStats(alg->name(), double(mIntegrand.evaluations() - evaluations) / runCount);
 			alg->printStats();
 		}
 		std::cout << std::endl;
@@ -61,10 +120,18 @@ public:
 		}
 	}
 private:
+	// Exact, the floats in hexadecimal
+	static std::string mixtureKey(const uint32_t countDistributions, const Float minWeight, const Float maxWeight, const Float avgScale, const Float diffScale, const uint64_t seed) {
+		std::ostringstream key;
+		key << std::hexfloat << "mixture " << countDistributions << " " << minWeight << " " << maxWeight << " " << avgScale << " " << diffScale << " " << seed;
+		return key.str();
+	}
+
 	template<typename TAlgorithm, typename ... Types>
 	bool tryCreateAlgorithm(const std::string &name, Types&& ... params) {
 		if (TAlgorithm::sName() == name) {
-			mAlgorithms.push_back(new TAlgorithm(mIntegrand, std::forward<Types>(params)...));
+			mFactories.push_back([this, params...]() -> Algorithm<TDimension, TFloat>* { return new TAlgorithm(mIntegrand, params...); });
+			mAlgorithms.push_back(mFactories.back()());
 			return true;
 		}
 		return false;
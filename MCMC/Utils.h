@@ -3,42 +3,87 @@
 #include "Vector.h"
 #include <tuple>
 #include <vector>
+#include <limits>
+#include <cmath>
 
-template<uint32_t TDim>
-INLINE Vector<TDim> randomVector(Pcg& rnd) {
-	Vector<TDim> temp;
+constexpr Float LOG_ZERO = -std::numeric_limits<Float>::infinity();
+
+// Log domain counterpart of min(1, nominator / denominator)
+template<typename TFloat>
+INLINE TFloat ratioFromLog(const TFloat logRatio) {
+	return logRatio < TFloat(0) ? exp(logRatio) : TFloat(1);
+}
+
+// Neumaier's compensated sum, the rounding error of every addition is kept and added back at the end
+class CompensatedSum {
+	double mSum, mCompensation;
+public:
+	INLINE CompensatedSum() : mSum(0), mCompensation(0) {}
+
+	INLINE void add(const double value) {
+		const double sum = mSum + value;
+		if (std::abs(mSum) >= std::abs(value)) {
+			mCompensation += (mSum - sum) + value;
+		}
+		else {
+			mCompensation += (value - sum) + mSum;
+		}
+		mSum = sum;
+	}
+
+	INLINE void add(const CompensatedSum& other) {
+		add(other.mSum);
+		mCompensation += other.mCompensation;
+	}
+
+	INLINE double result() const {
+		return mSum + mCompensation;
+	}
+};
+
+template<uint32_t TDim, typename TFloat = Float>
+INLINE Vector<TDim, TFloat> randomVector(Pcg& rnd) {
+	Vector<TDim, TFloat> temp;
 	for (uint32_t i = 0; i < TDim; ++i) {
-		temp[i] = rnd();
+		temp[i] = rnd.uniform<TFloat>();
 	}
 	return temp;
 }
 
-template<uint32_t TDim>
-INLINE Vector<TDim> randomVectorExponential(Pcg& rnd, const Float b) {
-	Vector<TDim> temp;
+// Whole vector from one bulk fill of the lanes
+template<uint32_t TDim, typename TFloat = Float>
+INLINE Vector<TDim, TFloat> randomVector(PcgLanes& rnd) {
+	Vector<TDim, TFloat> temp;
+	rnd.fill(&temp[0], TDim);
+	return temp;
+}
+
+template<uint32_t TDim, typename TFloat = Float>
+INLINE Vector<TDim, TFloat> randomVectorExponential(Pcg& rnd, const TFloat b) {
+	Vector<TDim, TFloat> temp;
 	for (uint32_t i = 0; i < TDim; ++i) {
-		temp[i] = -log(1 - rnd() * (1 - exp(-b * 5))) / 5;
+		temp[i] = -log(1 - rnd.uniform<TFloat>() * (1 - exp(-b * 5))) / 5;
 	}
 	return temp;
 }
 
-template<typename TIterator, typename TCdf>
-INLINE std::tuple<TIterator, Float> sampleDiscrete(const TIterator begin, const TIterator end, const TCdf cdf, Float& rnd) {
+template<typename TIterator, typename TCdf, typename TFloat>
+INLINE std::tuple<TIterator, TFloat> sampleDiscrete(const TIterator begin, const TIterator end, const TCdf cdf, TFloat& rnd) {
 	using ValueType = typename std::iterator_traits<TIterator>::value_type;
 	const ValueType searched = ValueType(rnd * cdf(*(end - 1)));
 	TIterator found = std::upper_bound(begin, end, searched, [&cdf](const ValueType& a, const ValueType& b) { return cdf(a) < cdf(b); });
 	if (found == end) {
 		--found;
 	}
-	Float prev = found == begin ? Float(0) : cdf(*(found - 1));
-	Float pdf = cdf(*found) - prev;
+	TFloat prev = found == begin ? TFloat(0) : cdf(*(found - 1));
+	TFloat pdf = cdf(*found) - prev;
 	rnd = (cdf(searched) - prev) / pdf;
 	return std::make_tuple(found, pdf);
 }
 
-template<typename TIterator>
-INLINE std::tuple<TIterator, Float> sampleDiscrete(const TIterator begin, const TIterator end, Float& rnd) {
-	return sampleDiscrete(begin, end, [](const Float a) { return a; }, rnd);
+template<typename TIterator, typename TFloat>
+INLINE std::tuple<TIterator, TFloat> sampleDiscrete(const TIterator begin, const TIterator end, TFloat& rnd) {
+	return sampleDiscrete(begin, end, [](const TFloat a) { return a; }, rnd);
 }
 
 template<uint32_t TPower>
@@ -102,18 +147,18 @@ INLINE Vector<3> hsvToRgb(const Vector<3>& hsv)
 }
 
 
-template<uint32_t TDim>
-INLINE Vector<TDim> log(const Vector<TDim>& v) {
-	Vector<TDim> temp;
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<TDim, TFloat> log(const Vector<TDim, TFloat>& v) {
+	Vector<TDim, TFloat> temp;
 	for (uint32_t i = 0; i < TDim; ++i) {
 		temp[i] = log(v[i]);
 	}
 	return temp;
 }
 
-template<uint32_t TDim>
-INLINE Vector<TDim> exp(const Vector<TDim>& v) {
-	Vector<TDim> temp;
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<TDim, TFloat> exp(const Vector<TDim, TFloat>& v) {
+	Vector<TDim, TFloat> temp;
 	for (uint32_t i = 0; i < TDim; ++i) {
 		temp[i] = exp(v[i]);
 	}
@@ -131,21 +176,21 @@ INLINE Float halton(const uint32_t base, uint32_t i) {
 }
 
 constexpr static uint32_t PRIMES[] = { 2, 3, 5, 11, 17, 23, 31, 43, 59, 71, 89, 107, 131, 149, 163, 191, 211, 227};
-template<uint32_t TDim>
-INLINE Vector<TDim> haltonVector(uint32_t index) {
-	Vector<TDim> temp;
+template<uint32_t TDim, typename TFloat = Float>
+INLINE Vector<TDim, TFloat> haltonVector(uint32_t index) {
+	Vector<TDim, TFloat> temp;
 	for (uint32_t d = 0; d < TDim; ++d) {
-		temp[d] = halton(PRIMES[d], index);
+		temp[d] = TFloat(halton(PRIMES[d], index));
 	}
 	return temp;
 }
 
-template<uint32_t TDim>
-INLINE void nRooks(Pcg& rnd, std::vector<Vector<TDim>>& out) {
-	const Vector<TDim> strata(Float(1) / out.size());
+template<uint32_t TDim, typename TFloat>
+INLINE void nRooks(Pcg& rnd, std::vector<Vector<TDim, TFloat>>& out) {
+	const Vector<TDim, TFloat> strata(TFloat(1) / out.size());
 	// Generate initial positions
 	for (uint32_t i = 0; i < out.size(); ++i) {
-		out[i] = randomVector<TDim>(rnd) * strata + strata * Float(i);
+		out[i] = randomVector<TDim, TFloat>(rnd) * strata + strata * TFloat(i);
 	}
 	// Shuffle each dimension (except the first one)
 	for (uint32_t d = 1; d < TDim; ++d) {
@@ -1,15 +1,15 @@
 #pragma once
 #include "Config.h"
 
-template<uint32_t TDim>
+template<uint32_t TDim, typename TFloat = Float>
 class Vector {
 	static_assert(TDim >= 1, "Dimension must be positive.");
-	Float mData[TDim];
+	TFloat mData[TDim];
 public:
 
 	INLINE Vector() = default;
 
-	INLINE Vector(const Float x) {
+	INLINE Vector(const TFloat x) {
 		for (int i = 0; i < TDim; ++i) {
 			mData[i] = x;
 		}
@@ -84,31 +84,31 @@ public:
 		return temp;
 	}
 
-	INLINE Float operator[](const uint32_t index) const {
+	INLINE TFloat operator[](const uint32_t index) const {
 		assert(index >= 0 && index < TDim);
 		return mData[index];
 	}
 
-	INLINE Float& operator[](const uint32_t index) {
+	INLINE TFloat& operator[](const uint32_t index) {
 		assert(index >= 0 && index < TDim);
 		return mData[index];
 	}
 
-	INLINE Vector operator*=(const Float f) {
+	INLINE Vector operator*=(const TFloat f) {
 		for (int i = 0; i < TDim; ++i) {
 			mData[i] *= f;
 		}
 		return *this;
 	}
 
-	INLINE Vector operator/=(const Float f) {
+	INLINE Vector operator/=(const TFloat f) {
 		for (int i = 0; i < TDim; ++i) {
 			mData[i] /= f;
 		}
 		return *this;
 	}
 
-	INLINE Vector operator*(const Float f) const {
+	INLINE Vector operator*(const TFloat f) const {
 		Vector temp;
 		for (int i = 0; i < TDim; ++i) {
 			temp[i] = mData[i] * f;
@@ -116,7 +116,7 @@ public:
 		return temp;
 	}
 
-	INLINE Vector operator/(const Float f) const {
+	INLINE Vector operator/(const TFloat f) const {
 		Vector temp;
 		for (int i = 0; i < TDim; ++i) {
 			temp[i] = mData[i] / f;
@@ -125,28 +125,28 @@ public:
 	}
 };
 
-template<uint32_t TDim>
-INLINE Vector<TDim> magnitudeSqr(const Vector<TDim>& v) {
-	Float sqrSum = Float(0);
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<TDim, TFloat> magnitudeSqr(const Vector<TDim, TFloat>& v) {
+	TFloat sqrSum = TFloat(0);
 	for (int i = 0; i < TDim; ++i) {
 		sqrSum += v[i] * v[i];
 	}
 	return sqrSum;
 }
 
-template<uint32_t TDim>
-INLINE Vector<TDim> magnitude(const Vector<TDim>& v) {
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<TDim, TFloat> magnitude(const Vector<TDim, TFloat>& v) {
 	return sqrt(magnitudeSqr(v));
 }
 
-template<uint32_t TDim>
-INLINE Vector<TDim> normalize(const Vector<TDim>& v) {
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<TDim, TFloat> normalize(const Vector<TDim, TFloat>& v) {
 	return v / magnitude(v);
 }
 
-template<uint32_t TDim>
-INLINE Float dot(const Vector<TDim>& v1, const Vector<TDim>& v2) {
-	Float product = Float(0);
+template<uint32_t TDim, typename TFloat>
+INLINE TFloat dot(const Vector<TDim, TFloat>& v1, const Vector<TDim, TFloat>& v2) {
+	TFloat product = TFloat(0);
 	for (int i = 0; i < TDim; ++i) {
 		product += v1[i] * v2[i];
 	}
@@ -155,15 +155,16 @@ INLINE Float dot(const Vector<TDim>& v1, const Vector<TDim>& v2) {
 
 using Vector2 = Vector<2>;
 
-INLINE Vector2 makeVector2(const Float v0, const Float v1) {
-	Vector2 temp;
+template<typename TFloat>
+INLINE Vector<2, TFloat> makeVector2(const TFloat v0, const TFloat v1) {
+	Vector<2, TFloat> temp;
 	temp[0] = v0;
 	temp[1] = v1;
 	return temp;
 }
 
-template<uint32_t TDim>
-INLINE Vector2 pickVector2(const Vector<TDim> x, const uint32_t startIndex) {
+template<uint32_t TDim, typename TFloat>
+INLINE Vector<2, TFloat> pickVector2(const Vector<TDim, TFloat> x, const uint32_t startIndex) {
 	assert(startIndex >= 0 && startIndex + 1 < TDim);
 	return makeVector2(x[startIndex], x[startIndex + 1]);
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "Benchmarks.h"
+#include <cstdlib>
+
+// Usage: mcmc_benchmark [--filter=<case name part>] [--min-time=<milliseconds>]
+int main(int argc, char ** argv) {
+	BenchmarkOptions options;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg.rfind("--filter=", 0) == 0) {
+			options.filter = arg.substr(9);
+		}
+		else if (arg.rfind("--min-time=", 0) == 0) {
+			options.minMilliseconds = atof(arg.substr(11).c_str());
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--filter=<case name part>] [--min-time=<milliseconds>]" << std::endl;
+			return 1;
+		}
+	}
+	runBenchmarkSuite(options);
+	return 0;
+}
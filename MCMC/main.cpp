@@ -1,13 +1,15 @@
 #include "TestSuite.h"
+#include "Benchmarks.h"
 
 void scenario1(const std::vector<Float>& temperatures) {
-	TestSuite<2> testSuite(50, 1.f, 1.f, 0.00001f, 10.f, 13370);
+	TestSuite<2> testSuite(50, 1.f, 1.f, 0.00001f, 10.f, 13370, ".");
 	//testSuite.addAlgorithm<ReferenceAlgorithm<2>>();
 	//testSuite.addAlgorithm<UniformAlgorithm<4>>();
 	//testSuite.addAlgorithm<HaltonAlgorithm<4>>();
 	//testSuite.addAlgorithm<MetropolisHastingsAlgorithm<2>>();
 	//testSuite.addAlgorithm("GlobalAdaptation");
 	//testSuite.addAlgorithm<ParallelTemperingAlgorithm<2>>(temperatures);
+	//testSuite.addAlgorithm<ParallelTemperingAlgorithm<2>>(temperatures, ParallelTemperingType::DEO, 0);
 	//testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<2>>(temperatures, 8, EquiEnergyMovesType::ORIGINAL);
 	//testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<2>>(temperatures, 8, EquiEnergyMovesType::FREQUENT_FALLBACK);
 	//testSuite.addAlgorithm<PermutationsAlgorithm<2>>(temperatures, PermutationsType::ALL);
@@ -15,40 +17,48 @@ void scenario1(const std::vector<Float>& temperatures) {
 	testSuite.addAlgorithm<SampledSwapsAlgorithm<2>>(temperatures);
 	//testSuite.addAlgorithm<AdaptiveEESAlgorithm<2>>(temperatures, 12, Float(0.01), EESType::ADAPTIVE);
 	//testSuite.addAlgorithm<AdaptiveEESAlgorithm<2>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE);
+	//testSuite.addAlgorithm<AdaptiveEESAlgorithm<2>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE, EESSchedule::PIPELINED, 0);
 	testSuite.runAll(10, 10000);
 }
 
 void scenario2(const std::vector<Float>& temperatures) {
-	TestSuite<8> testSuite(10, 1.f, 1.f, 0.0001f, 10.f, 13370);
+	TestSuite<8> testSuite(10, 1.f, 1.f, 0.0001f, 10.f, 13370, ".");
 	//testSuite.addAlgorithm<ReferenceAlgorithm<8>>();
 	//testSuite.addAlgorithm<UniformAlgorithm<4>>();
 	//testSuite.addAlgorithm<HaltonAlgorithm<4>>();
 	testSuite.addAlgorithm<MetropolisHastingsAlgorithm<8>>();
 	//testSuite.addAlgorithm("GlobalAdaptation");
 	testSuite.addAlgorithm<ParallelTemperingAlgorithm<8>>(temperatures);
+	//testSuite.addAlgorithm<ParallelTemperingAlgorithm<8>>(temperatures, ParallelTemperingType::DEO, 0);
 	testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<8>>(temperatures, 8, EquiEnergyMovesType::ORIGINAL);
 	testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<8>>(temperatures, 8, EquiEnergyMovesType::FREQUENT_FALLBACK);
 	testSuite.addAlgorithm<PermutationsAlgorithm<8>>(temperatures, PermutationsType::ALL);
 	testSuite.addAlgorithm<PermutationsAlgorithm<8>>(temperatures, PermutationsType::NON_IDENTITY);
 	testSuite.addAlgorithm<AdaptiveEESAlgorithm<8>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE);
-	testSuite.runAll(100, 10000);
+	testSuite.runAll(100, 10000, 0);
 }
 
 template<int TDim>
 void scenarioVariable(const std::vector<Float>& temperatures) {
-	TestSuite<TDim> testSuite(10, 1.f, 1.f, 0.0001f, 10.f, 13370);
-	//testSuite.addAlgorithm<ReferenceAlgorithm<8>>();
-	//testSuite.addAlgorithm<UniformAlgorithm<4>>();
-	//testSuite.addAlgorithm<HaltonAlgorithm<4>>();
-	//testSuite.addAlgorithm<MetropolisHastingsAlgorithm<TDim>>();
+	TestSuite<TDim> testSuite(10, 1.f, 1.f, 0.0001f, 10.f, 13370, ".");
+	//TestSuite<TDim> testSuite(10, 1.f, 1.f, 0.0001f, 10.f, 13370, ".", 100000000); // A finer reference, for machines with many cores
+	//testSuite.template addAlgorithm<ReferenceAlgorithm<8>>();
+	//testSuite.template addAlgorithm<UniformAlgorithm<4>>();
+	//testSuite.template addAlgorithm<HaltonAlgorithm<4>>();
+	//testSuite.template addAlgorithm<MetropolisHastingsAlgorithm<TDim>>();
 	//testSuite.addAlgorithm("GlobalAdaptation");
-	//testSuite.addAlgorithm<ParallelTemperingAlgorithm<TDim>>(temperatures);
-	//testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<TDim>>(temperatures, 8, EquiEnergyMovesType::ORIGINAL);
-	//testSuite.addAlgorithm<EquiEnergyMovesAlgorithm<TDim>>(temperatures, 8, EquiEnergyMovesType::FREQUENT_FALLBACK);
-	//testSuite.addAlgorithm<PermutationsAlgorithm<TDim>>(temperatures, PermutationsType::ALL);
-	//testSuite.addAlgorithm<PermutationsAlgorithm<TDim>>(temperatures, PermutationsType::NON_IDENTITY);
-	testSuite.addAlgorithm<SampledSwapsAlgorithm<TDim>>(temperatures);
-	//testSuite.addAlgorithm<AdaptiveEESAlgorithm<TDim>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE);
+	//testSuite.template addAlgorithm<ParallelTemperingAlgorithm<TDim>>(temperatures);
+	//testSuite.template addAlgorithm<ParallelTemperingAlgorithm<TDim>>(temperatures, ParallelTemperingType::DEO, 0);
+	//testSuite.template addAlgorithm<EquiEnergyMovesAlgorithm<TDim>>(temperatures, 8, EquiEnergyMovesType::ORIGINAL);
+	//testSuite.template addAlgorithm<EquiEnergyMovesAlgorithm<TDim>>(temperatures, 8, EquiEnergyMovesType::FREQUENT_FALLBACK);
+	//testSuite.template addAlgorithm<PermutationsAlgorithm<TDim>>(temperatures, PermutationsType::ALL);
+	//testSuite.template addAlgorithm<PermutationsAlgorithm<TDim>>(temperatures, PermutationsType::NON_IDENTITY);
+	//testSuite.template addAlgorithm<PermutationsAlgorithm<TDim>>(temperatures, PermutationsType::METROPOLIS);
+	testSuite.template addAlgorithm<SampledSwapsAlgorithm<TDim>>(temperatures);
+	//testSuite.template addAlgorithm<AdaptiveEESAlgorithm<TDim>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE);
+	//testSuite.template addAlgorithm<AdaptiveEESAlgorithm<TDim>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE, EESSchedule::PIPELINED, 0);
+	//testSuite.template addAlgorithm<AdaptiveEESAlgorithm<TDim>>(temperatures, 16, Float(0.1f), EESType::ADAPTIVE, EESSchedule::CHAIN_BY_CHAIN, 1, 4096);
+	//testSuite.template addAlgorithm<AdaptiveEESAlgorithm<TDim>>(temperatures, 16, Float(0.1f), EESType::SKETCH, EESSchedule::CHAIN_BY_CHAIN, 1, 4096, 200);
 	testSuite.runAll(1, 10000);
 }
 
@@ -77,5 +87,12 @@ int main(int argc, char ** argv) {
 	scenarioVariable<12>(temperatures);
 
 	scenarioVariable<14>(temperatures);*/
+
+	/*benchmarkAllTemperatures<8>(8, 100000);
+	benchmarkAllTemperatures<8>(16, 100000);
+	benchmarkRandomVectors<14>(10000000);
+	benchmarkPrecision<2>(8, 100000);
+	benchmarkPrecision<8>(8, 100000);
+	benchmarkPrecision<14>(8, 100000);*/
 	return 0;
 }
\ No newline at end of file
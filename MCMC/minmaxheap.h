@@ -1,23 +1,116 @@
 #pragma once
 
 #include <stdint.h>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <vector>
+#if defined(_MSC_VER)
 #include <intrin.h>
+#endif
 
+// Storage for heaps in power of two blocks, a block given back is kept for the next heap that grows to its size, so
+// heaps that are emptied and filled again (every run) stop allocating. Heaps on several threads may share one, it has
+// to outlive them
+template<typename T>
+class HeapArena
+{
+public:
+	HeapArena() :m_bytes(0) {}
+
+	HeapArena(const HeapArena &) = delete;
+	HeapArena & operator=(const HeapArena &) = delete;
+
+	~HeapArena() {
+		trim();
+	}
+
+	T * allocate(size_t sizeLog2) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (sizeLog2 < m_free.size() && !m_free[sizeLog2].empty()) {
+			T * block = m_free[sizeLog2].back();
+			m_free[sizeLog2].pop_back();
+			return block;
+		}
+		m_bytes += (size_t(1) << sizeLog2) * sizeof(T);
+		return new T[size_t(1) << sizeLog2];
+	}
+
+	void deallocate(T * block, size_t sizeLog2) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (sizeLog2 >= m_free.size())
+			m_free.resize(sizeLog2 + 1);
+		m_free[sizeLog2].push_back(block);
+	}
+
+	// Frees the blocks that are not in use
+	void trim() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t sizeLog2 = 0; sizeLog2 < m_free.size(); ++sizeLog2) {
+			for (T * block : m_free[sizeLog2]) {
+				delete[] block;
+				m_bytes -= (size_t(1) << sizeLog2) * sizeof(T);
+			}
+			m_free[sizeLog2].clear();
+		}
+	}
+
+	// In use or kept
+	size_t bytes() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_bytes;
+	}
+private:
+	std::mutex m_mutex;
+	std::vector<std::vector<T *>> m_free; // By log2 of the block size
+	size_t m_bytes;
+};
+
+// Min-max heap, without an arena the storage comes from new[]
 template<typename T>
 class Heap
 {
 public:
 
-	Heap() :m_innerHeap(0), m_allocated(0), m_size(0) {}
+	explicit Heap(HeapArena<T> * arena = 0) :m_innerHeap(0), m_allocated(0), m_size(0), m_arena(arena) {}
+
+	Heap(const Heap &) = delete;
+	Heap & operator=(const Heap &) = delete;
+
+	Heap(Heap && other) noexcept :m_innerHeap(other.m_innerHeap), m_allocated(other.m_allocated), m_size(other.m_size), m_arena(other.m_arena) {
+		other.m_innerHeap = 0;
+		other.m_allocated = 0;
+		other.m_size = 0;
+	}
+
+	Heap & operator=(Heap && other) noexcept {
+		if (this != &other) {
+			release();
+			m_innerHeap = other.m_innerHeap;
+			m_allocated = other.m_allocated;
+			m_size = other.m_size;
+			m_arena = other.m_arena;
+			other.m_innerHeap = 0;
+			other.m_allocated = 0;
+			other.m_size = 0;
+		}
+		return *this;
+	}
 
 	~Heap() {
-		delete[] m_innerHeap;
+		release();
 	}
 
 	size_t size() const {
 		return m_size;
 	}
 
+	size_t capacity() const {
+		return m_allocated;
+	}
+
 	bool empty() const {
 		return m_size == 0;
 	}
@@ -50,6 +143,45 @@ public:
 		m_size = 0;
 	}
 
+	// Clears and frees the storage (back to the arena if there is one)
+	void release() {
+		if (m_innerHeap) {
+			if (m_arena)
+				m_arena->deallocate(m_innerHeap, log2(m_allocated));
+			else
+				delete[] m_innerHeap;
+		}
+		m_innerHeap = 0;
+		m_allocated = 0;
+		m_size = 0;
+	}
+
+	// Room for at least count elements without another allocation
+	void reserve(size_t count) {
+		if (count <= m_allocated)
+			return;
+		const size_t sizeLog2 = count <= 64 ? 6 : log2(count - 1) + 1; // At least 64, a power of two for the arena
+		T * temp = m_arena ? m_arena->allocate(sizeLog2) : new T[size_t(1) << sizeLog2];
+		if (m_size > 0)
+			memcpy(temp, m_innerHeap, m_size * sizeof(T));
+		const size_t size = m_size;
+		release();
+		m_innerHeap = temp;
+		m_allocated = size_t(1) << sizeLog2;
+		m_size = size;
+	}
+
+	// Replaces the contents in O(n): Floyd's construction, every subtree is trickled down from the last father up
+	template<typename TIterator>
+	void build(TIterator first, TIterator last) {
+		m_size = 0;
+		reserve(size_t(std::distance(first, last)));
+		for (; first != last; ++first)
+			m_innerHeap[m_size++] = *first;
+		for (size_t index = m_size / 2; index-- > 0;)
+			down(index);
+	}
+
 	void remove_min() {
 		if (m_size == 0)
 			return;
@@ -72,23 +204,50 @@ public:
 				down(2);
 			}
 		}
+		else if (m_size == 2 && m_innerHeap[2] < m_innerHeap[1]) {
+			m_innerHeap[1] = m_innerHeap[2]; // The maximum was the first son, the second one takes its place
+		}
 	}
 
 	void remove(size_t index) {
 		assert(index < m_size);
 		--m_size;
+		if (index == m_size)
+			return;
 		m_innerHeap[index] = m_innerHeap[m_size];
-		down(index);
+		restore(index);
 	}
 
 	void updateValue(const T & newValue, size_t index) {
 		assert(index < m_size);
-		if (m_innerHeap[index] < newValue)
-			up(index);
+		m_innerHeap[index] = newValue;
+		restore(index);
+	}
+private:
+	// The element at index may break the order both with its ancestors and its descendants
+	void restore(size_t index) {
+		const size_t father = (index - 1) >> 1;
+		const bool min = minLevel(index);
+		if (index > 0 && (min ? m_innerHeap[father] < m_innerHeap[index] : m_innerHeap[index] < m_innerHeap[father])) {
+			// Beyond the father, so it goes up the other levels and the father's value goes down from index
+			std::swap(m_innerHeap[father], m_innerHeap[index]);
+			if (min)
+				up_max(father);
+			else
+				up_min(father);
+			down(index);
+			return;
+		}
+		const size_t grandparent = (father - 1) >> 1;
+		if (index > 2 && (min ? m_innerHeap[index] < m_innerHeap[grandparent] : m_innerHeap[grandparent] < m_innerHeap[index])) {
+			if (min)
+				up_min(index);
+			else
+				up_max(index);
+		}
 		else
 			down(index);
 	}
-private:
 
 	inline bool less(size_t index1, size_t index2, size_t level) {
 		return (((level % 2) == 1 && m_innerHeap[index1] < m_innerHeap[index2]) ||
@@ -96,9 +255,13 @@ private:
 	}
 
 	static inline size_t log2(size_t x) {
+#if defined(_MSC_VER)
 		unsigned long index;
 		_BitScanReverse64(&index, x); // always x > 0
 		return index;
+#else
+		return 63 - __builtin_clzll(x); // always x > 0
+#endif
 	}
 
 	inline size_t getLevel(size_t index) {
@@ -229,16 +392,11 @@ private:
 	}
 
 	void push_back(const T & value) {
-		if (m_size == m_allocated) {
-			size_t n = std::max((size_t)50, m_size * 2);
-			T * temp = new T[n];
-			memcpy(temp, m_innerHeap, m_size * sizeof(T));
-			delete[] m_innerHeap;
-			m_innerHeap = temp;
-			m_allocated = n;
-		}
+		if (m_size == m_allocated)
+			reserve(m_size + 1);
 		m_innerHeap[m_size++] = value;
 	}
 	T * m_innerHeap;
-	size_t m_size, m_allocated;
+	size_t m_allocated, m_size;
+	HeapArena<T> * m_arena;
 };
\ No newline at end of file